@@ -7,6 +7,7 @@ int main() {
     core::NodeHandler nh;
     core::Rate rate(1);
     core::ServiceClient<hello::hellorequest, hello::helloreply> &clt = nh.serviceClient<hello::hellorequest, hello::helloreply>("hello");
+    clt.waitForMatched(1, std::chrono::seconds(5));
     int i = 0;
     while (1)
     {
@@ -0,0 +1,102 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "serviceserving.grpc.pb.h"
+
+/*
+ * Client side load balancing over every server of a service.
+ * The servers are kept in a copy-on-write list, so picking one never waits for a call in progress.
+ */
+namespace core {
+    enum class Balance {
+        ROUND_ROBIN,
+        /* the server with the fewest calls of this client in flight */
+        LEAST_OUTSTANDING,
+        /* the less loaded of two random servers, close to LEAST_OUTSTANDING without scanning them all */
+        POWER_OF_TWO
+    };
+    class ServerPool {
+        public:
+        struct Server {
+            std::string key;
+            std::unique_ptr<ServerClient::Stub> stub;
+            std::atomic<int> outstanding{0};
+        };
+        using ServerPtr = std::shared_ptr<Server>;
+        ServerPool(Balance balance) : balance(balance), next(0), servers(std::make_shared<const List>()) {}
+        /* false if the server at key is already known. channel is the node's shared one to the server */
+        bool add(const std::string &key, const std::shared_ptr<grpc::Channel> &channel) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::shared_ptr<const List> current = std::atomic_load(&this->servers);
+            for (const ServerPtr &server : *current) {
+                if (server->key == key) return false;
+            }
+            ServerPtr server = std::make_shared<Server>();
+            server->key = key;
+            server->stub.reset(new ServerClient::Stub(channel));
+            std::shared_ptr<List> updated = std::make_shared<List>(*current);
+            updated->push_back(server);
+            std::atomic_store(&this->servers, std::shared_ptr<const List>(updated));
+            return true;
+        }
+        /* calls already sent to the server still finish */
+        bool remove(const std::string &key) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::shared_ptr<const List> current = std::atomic_load(&this->servers);
+            std::shared_ptr<List> updated = std::make_shared<List>();
+            for (const ServerPtr &server : *current) {
+                if (server->key != key) updated->push_back(server);
+            }
+            if (updated->size() == current->size()) return false;
+            std::atomic_store(&this->servers, std::shared_ptr<const List>(updated));
+            return true;
+        }
+        size_t size() {
+            return std::atomic_load(&this->servers)->size();
+        }
+        /* the server for the next call, counted as outstanding until done(); nullptr without servers */
+        ServerPtr pick() {
+            std::shared_ptr<const List> current = std::atomic_load(&this->servers);
+            if (current->empty()) return nullptr;
+            size_t count = current->size();
+            size_t start = this->next++ % count;
+            ServerPtr chosen = (*current)[start];
+            if (this->balance == Balance::LEAST_OUTSTANDING) {
+                /* scanning from the round robin position spreads the ties */
+                for (size_t i = 1; i < count; i++) {
+                    const ServerPtr &server = (*current)[(start + i) % count];
+                    if (server->outstanding < chosen->outstanding) chosen = server;
+                }
+            }
+            else if (this->balance == Balance::POWER_OF_TWO && count > 1) {
+                static thread_local std::minstd_rand random(std::random_device{}());
+                size_t first = random() % count;
+                size_t second = (first + 1 + random() % (count - 1)) % count;
+                chosen = (*current)[first];
+                if ((*current)[second]->outstanding < chosen->outstanding) chosen = (*current)[second];
+            }
+            chosen->outstanding++;
+            return chosen;
+        }
+        void done(const ServerPtr &server) {
+            server->outstanding--;
+        }
+        private:
+        using List = std::vector<ServerPtr>;
+        Balance balance;
+        std::atomic<size_t> next;
+        /* writers serialize on mutex_, readers only load the current list */
+        std::mutex mutex_;
+        std::shared_ptr<const List> servers;
+    };
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CHANNELCACHE_H
+#define CHANNELCACHE_H
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <grpcpp/grpcpp.h>
+
+/*
+ * One gRPC channel per target for the whole node, shared by every stub talking to that node:
+ * topic handshakes and service calls to the same peer reuse its connection instead of resolving
+ * and handshaking again. A channel nobody else holds is dropped after idle time without a get().
+ */
+namespace core {
+    class ChannelCache {
+        public:
+        ChannelCache(std::chrono::milliseconds idle) : idle(idle), stopped(false) {
+            this->expiry_thread = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                while (!this->cv_.wait_for(lock, this->idle / 2, [this]() { return this->stopped; })) this->expire();
+            });
+        }
+        ~ChannelCache() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->stopped = true;
+            }
+            this->cv_.notify_all();
+            this->expiry_thread.join();
+        }
+        /* the cached channel to target ("ip:port" or "unix-abstract:name"), created on first use */
+        std::shared_ptr<grpc::Channel> get(const std::string &target) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            Entry &entry = this->channels[target];
+            if (!entry.channel) entry.channel = grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+            entry.last_used = std::chrono::steady_clock::now();
+            return entry.channel;
+        }
+        /* starts connecting right away, so the first call does not wait for the handshake */
+        std::shared_ptr<grpc::Channel> warm(const std::string &target) {
+            std::shared_ptr<grpc::Channel> channel = this->get(target);
+            channel->GetState(true);
+            return channel;
+        }
+        size_t size() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->channels.size();
+        }
+        private:
+        struct Entry {
+            std::shared_ptr<grpc::Channel> channel;
+            std::chrono::steady_clock::time_point last_used;
+        };
+        /* a channel still held by a stub stays, whatever its age. Called with mutex_ held */
+        void expire() {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (auto iter = this->channels.begin(); iter != this->channels.end();) {
+                if (iter->second.channel.use_count() == 1 && now - iter->second.last_used > this->idle) iter = this->channels.erase(iter);
+                else iter++;
+            }
+        }
+        std::chrono::milliseconds idle;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stopped;
+        std::map<std::string, Entry> channels;
+        std::thread expiry_thread;
+    };
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Registrar.h"
+
+/*
+ * Master-less discovery (CORE_DISCOVERY=multicast).
+ * Every node multicasts a Beacon with what it publishes, subscribes, serves and calls, about once a
+ * second and right after each change, and keeps the beacons of its peers. A subscriber connects to
+ * every publisher of its topic it learns about through the Connection service, exactly as it does
+ * when the master announces one; a service client balances over every server of its service.
+ * Multicast loopback covers the nodes on the same host, so no shared registry is needed for them.
+ */
+namespace core {
+    class Discovery : public Registrar {
+        public:
+        static const int BEACON_INTERVAL_MS = 1000;
+        /* a peer is forgotten after missing about three beacons */
+        static const int PEER_TTL_MS = 3500;
+        /* group is "ip:port" of the multicast group, lost is told about peers that went silent */
+        Discovery(const EndPoint &self, std::string group, Found lost, bool &ret) : lost(lost) {
+            ret = false;
+            *this->beacon.mutable_node()->mutable_endpoint() = self;
+            this->beacon.set_ttl_ms(PEER_TTL_MS);
+            this->self_key = key(self);
+            size_t colon = group.rfind(':');
+            if (colon == std::string::npos) {
+                std::cerr << "Invalid discovery group " << group << ", expected ip:port\n";
+                return;
+            }
+            memset(&this->group_addr, 0, sizeof(this->group_addr));
+            this->group_addr.sin_family = AF_INET;
+            this->group_addr.sin_port = htons(atoi(group.substr(colon + 1).c_str()));
+            if (inet_pton(AF_INET, group.substr(0, colon).c_str(), &this->group_addr.sin_addr) != 1) {
+                std::cerr << "Invalid discovery group " << group << "\n";
+                return;
+            }
+            this->sock = socket(AF_INET, SOCK_DGRAM, 0);
+            if (this->sock < 0) {
+                std::cerr << "Discovery socket creation error\n";
+                return;
+            }
+            /* every node on the host listens on the same group port */
+            int yes = 1;
+            setsockopt(this->sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            setsockopt(this->sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+            sockaddr_in any;
+            memset(&any, 0, sizeof(any));
+            any.sin_family = AF_INET;
+            any.sin_port = this->group_addr.sin_port;
+            any.sin_addr.s_addr = htonl(INADDR_ANY);
+            if (bind(this->sock, (sockaddr*)&any, sizeof(any)) < 0) {
+                std::cerr << "Discovery bind error on port " << ntohs(any.sin_port) << "\n";
+                close(this->sock);
+                this->sock = -1;
+                return;
+            }
+            /* beacons leave and arrive on the interface of our CORE_LOCAL_IP */
+            ip_mreq membership;
+            membership.imr_multiaddr = this->group_addr.sin_addr;
+            inet_pton(AF_INET, self.ip().c_str(), &membership.imr_interface);
+            if (setsockopt(this->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+                std::cerr << "Cannot join discovery group " << group << " on " << self.ip() << "\n";
+                close(this->sock);
+                this->sock = -1;
+                return;
+            }
+            setsockopt(this->sock, IPPROTO_IP, IP_MULTICAST_IF, &membership.imr_interface, sizeof(membership.imr_interface));
+            unsigned char ttl = 1, loop = 1;
+            setsockopt(this->sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+            setsockopt(this->sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+            timeval timeout = {0, 200000};
+            setsockopt(this->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            this->threads.emplace_back([this]() { this->receive_loop(); });
+            this->threads.emplace_back([this]() {
+                do this->send_beacon();
+                while (!this->stopping(std::chrono::milliseconds(BEACON_INTERVAL_MS)));
+            });
+            ret = true;
+        }
+        /* no beacon is sent or handled any more once this returns */
+        ~Discovery() {
+            {
+                std::lock_guard<std::mutex> lock(this->stop_mutex_);
+                this->stopped = true;
+            }
+            this->stop_cv_.notify_all();
+            if (this->sock >= 0) shutdown(this->sock, SHUT_RDWR);
+            for (std::thread &thread : this->threads) thread.join();
+            if (this->sock >= 0) close(this->sock);
+        }
+        /* the subscribers dial in themselves, found is never called */
+        void advertise(const std::string &topic, const std::string &type_name, Found found) override {
+            this->change([&](GraphNode &node) { node.add_publishes(topic); });
+        }
+        void serve(const std::string &service) override {
+            this->change([&](GraphNode &node) { node.add_serves(service); });
+        }
+        void subscribe(const std::string &topic, Found found) override {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->subscriptions.insert(std::make_pair(topic, found));
+                for (auto &peer : this->peers) {
+                    if (contains(peer.second.node.publishes(), topic)) dispatch(found, peer.second.node.endpoint());
+                }
+            }
+            this->change([&](GraphNode &node) { node.add_subscribes(topic); });
+        }
+        void call(const std::string &service, Found found) override {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->calls.insert(std::make_pair(service, found));
+                for (auto &peer : this->peers) {
+                    if (contains(peer.second.node.serves(), service)) dispatch(found, peer.second.node.endpoint());
+                }
+            }
+            this->change([&](GraphNode &node) { node.add_calls(service); });
+        }
+        private:
+        struct Peer {
+            GraphNode node;
+            std::chrono::steady_clock::time_point expiry;
+        };
+        static std::string key(const EndPoint &endpoint) {
+            return endpoint.ip() + ":" + std::to_string(endpoint.port());
+        }
+        static bool contains(const google::protobuf::RepeatedPtrField<std::string> &names, const std::string &name) {
+            return std::find(names.begin(), names.end(), name) != names.end();
+        }
+        /* our own node is a peer too, a subscriber in this process finds a publisher in this process */
+        void change(std::function<void(GraphNode&)> edit) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                edit(*this->beacon.mutable_node());
+                this->update(this->beacon.node(), std::chrono::steady_clock::time_point::max());
+            }
+            this->send_beacon();
+        }
+        /* with mutex_ held: tell the local subscriptions and calls about what the peer newly offers */
+        void update(const GraphNode &node, std::chrono::steady_clock::time_point expiry) {
+            std::string peer_key = key(node.endpoint());
+            auto iter = this->peers.find(peer_key);
+            bool known = iter != this->peers.end();
+            for (const std::string &topic : node.publishes()) {
+                if (known && contains(iter->second.node.publishes(), topic)) continue;
+                auto range = this->subscriptions.equal_range(topic);
+                for (auto sub = range.first; sub != range.second; sub++) dispatch(sub->second, node.endpoint());
+            }
+            for (const std::string &service : node.serves()) {
+                if (known && contains(iter->second.node.serves(), service)) continue;
+                auto range = this->calls.equal_range(service);
+                for (auto clt = range.first; clt != range.second; clt++) dispatch(clt->second, node.endpoint());
+            }
+            if (!known) std::cout << "Discovered node " << peer_key << "\n";
+            Peer &peer = this->peers[peer_key];
+            peer.node = node;
+            peer.expiry = expiry;
+        }
+        void send_beacon() {
+            std::string data;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->beacon.SerializeToString(&data);
+            }
+            sendto(this->sock, data.data(), data.size(), 0, (sockaddr*)&this->group_addr, sizeof(this->group_addr));
+        }
+        /* waits up to delay, true once the destructor runs */
+        bool stopping(std::chrono::milliseconds delay) {
+            std::unique_lock<std::mutex> lock(this->stop_mutex_);
+            return this->stop_cv_.wait_for(lock, delay, [this]() { return this->stopped; });
+        }
+        /* recv times out every 200 ms, so the peers expire and the stop flag is seen without traffic */
+        void receive_loop() {
+            std::vector<char> buffer(65536);
+            Beacon received;
+            while (!this->stopping(std::chrono::milliseconds(0))) {
+                ssize_t size = recv(this->sock, buffer.data(), buffer.size(), 0);
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                std::vector<EndPoint> gone;
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    if (size > 0 && received.ParseFromArray(buffer.data(), size) &&
+                        received.node().endpoint().port() != 0 && key(received.node().endpoint()) != this->self_key) {
+                        this->update(received.node(), now + std::chrono::milliseconds(received.ttl_ms()));
+                    }
+                    for (auto iter = this->peers.begin(); iter != this->peers.end();) {
+                        if (iter->second.expiry > now) {
+                            iter++;
+                            continue;
+                        }
+                        std::cout << "Lost node " << iter->first << "\n";
+                        gone.push_back(iter->second.node.endpoint());
+                        iter = this->peers.erase(iter);
+                    }
+                }
+                for (const EndPoint &endpoint : gone) this->lost(endpoint);
+            }
+        }
+        int sock = -1;
+        sockaddr_in group_addr;
+        std::string self_key;
+        std::mutex mutex_;
+        Beacon beacon;
+        std::map<std::string, Peer> peers;
+        std::multimap<std::string, Found> subscriptions;
+        std::multimap<std::string, Found> calls;
+        Found lost;
+        std::mutex stop_mutex_;
+        std::condition_variable stop_cv_;
+        bool stopped = false;
+        std::vector<std::thread> threads;
+    };
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+
+#include "connection.pb.h"
+
+/*
+ * Content based filtering of a subscription.
+ * The subscriber sends its predicates in SubscriberRequest, the publisher resolves them against
+ * the published message type and only serializes/sends messages where all of them hold.
+ */
+namespace core {
+    class Filter {
+        public:
+        Filter() {}
+        /* field is a dotted path from the message root, e.g. "level" or "header.frameid".
+           value is compared as a number for numeric, bool and enum fields (enums also by name) and as text for strings */
+        Filter &where(std::string field, FieldFilter::Op op, std::string value) {
+            FieldFilter *predicate = this->predicates.Add();
+            predicate->set_field(field);
+            predicate->set_op(op);
+            predicate->set_value(value);
+            return *this;
+        }
+        Filter &where(std::string field, FieldFilter::Op op, const char *value) {
+            return this->where(field, op, std::string(value));
+        }
+        /* numbers are written with every digit the publisher needs to read back the same double,
+           1e-7 stays 1e-07 and a float compares equal to the float field it came from */
+        template<class V>
+        Filter &where(std::string field, FieldFilter::Op op, V value) {
+            std::ostringstream text;
+            text << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+            return this->where(field, op, text.str());
+        }
+        google::protobuf::RepeatedPtrField<FieldFilter> predicates;
+    };
+    class CompiledFilter {
+        public:
+        CompiledFilter(const google::protobuf::Descriptor *descriptor, const google::protobuf::RepeatedPtrField<FieldFilter> &filters) {
+            for (const FieldFilter &filter : filters) {
+                Predicate predicate;
+                std::string error = this->compile(descriptor, filter, predicate);
+                if (!error.empty()) {
+                    if (this->error_.empty()) this->error_ = "filter on " + descriptor->full_name() + "." + filter.field() + ": " + error;
+                    continue;
+                }
+                this->predicates.push_back(predicate);
+            }
+        }
+        bool empty() const { return this->predicates.empty(); }
+        /* what is wrong with the first bad predicate (unknown field, value of the wrong type), empty if none is.
+           A subscription with one is refused: leaving the predicate out would let everything through */
+        const std::string &error() const { return this->error_; }
+        bool matches(const google::protobuf::Message &msg) const {
+            for (const Predicate &predicate : this->predicates) {
+                if (!this->matches(msg, predicate)) return false;
+            }
+            return true;
+        }
+        private:
+        struct Predicate {
+            std::vector<const google::protobuf::FieldDescriptor*> path;
+            FieldFilter::Op op;
+            bool numeric;
+            double number;
+            std::string text;
+        };
+        /* empty if the predicate fits the message type, otherwise what is wrong with it */
+        std::string compile(const google::protobuf::Descriptor *descriptor, const FieldFilter &filter, Predicate &predicate) {
+            std::string field = filter.field();
+            size_t start = 0;
+            while (descriptor) {
+                size_t end = field.find('.', start);
+                const google::protobuf::FieldDescriptor *fd = descriptor->FindFieldByName(field.substr(start, end - start));
+                if (!fd) return "no such field";
+                predicate.path.push_back(fd);
+                if (end == std::string::npos) break;
+                if (fd->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE || fd->is_repeated()) return fd->name() + " has no fields";
+                descriptor = fd->message_type();
+                start = end + 1;
+            }
+            const google::protobuf::FieldDescriptor *leaf = predicate.path.back();
+            if (leaf->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) return "a message is not comparable";
+            predicate.op = filter.op();
+            predicate.text = filter.value();
+            predicate.numeric = leaf->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_STRING;
+            if (leaf->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_ENUM &&
+                leaf->enum_type()->FindValueByName(filter.value())) {
+                predicate.number = leaf->enum_type()->FindValueByName(filter.value())->number();
+            }
+            else if (leaf->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_BOOL) {
+                const std::string &value = filter.value();
+                if (value != "true" && value != "false" && value != "1" && value != "0") return "\"" + value + "\" is not a bool";
+                predicate.number = (value == "true" || value == "1") ? 1 : 0;
+            }
+            else if (predicate.numeric) {
+                const char *text = filter.value().c_str();
+                char *end = nullptr;
+                predicate.number = strtod(text, &end);
+                if (end == text || *end != '\0') return "\"" + filter.value() + "\" is not a number";
+            }
+            return "";
+        }
+        template<class V>
+        static bool compare(const V &lhs, FieldFilter::Op op, const V &rhs) {
+            switch (op) {
+                case FieldFilter::EQ: return lhs == rhs;
+                case FieldFilter::NE: return lhs != rhs;
+                case FieldFilter::LT: return lhs < rhs;
+                case FieldFilter::LE: return lhs <= rhs;
+                case FieldFilter::GT: return lhs > rhs;
+                case FieldFilter::GE: return lhs >= rhs;
+                default: return false;
+            }
+        }
+        static double number(const google::protobuf::Message &msg, const google::protobuf::FieldDescriptor *fd, int index) {
+            const google::protobuf::Reflection *reflection = msg.GetReflection();
+            bool repeated = index >= 0;
+            switch (fd->cpp_type()) {
+                case google::protobuf::FieldDescriptor::CPPTYPE_INT32: return repeated ? reflection->GetRepeatedInt32(msg, fd, index) : reflection->GetInt32(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_INT64: return repeated ? reflection->GetRepeatedInt64(msg, fd, index) : reflection->GetInt64(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_UINT32: return repeated ? reflection->GetRepeatedUInt32(msg, fd, index) : reflection->GetUInt32(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_UINT64: return repeated ? reflection->GetRepeatedUInt64(msg, fd, index) : reflection->GetUInt64(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE: return repeated ? reflection->GetRepeatedDouble(msg, fd, index) : reflection->GetDouble(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT: return repeated ? reflection->GetRepeatedFloat(msg, fd, index) : reflection->GetFloat(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_BOOL: return repeated ? reflection->GetRepeatedBool(msg, fd, index) : reflection->GetBool(msg, fd);
+                case google::protobuf::FieldDescriptor::CPPTYPE_ENUM: return repeated ? reflection->GetRepeatedEnumValue(msg, fd, index) : reflection->GetEnumValue(msg, fd);
+                default: return 0;
+            }
+        }
+        bool matches(const google::protobuf::Message &root, const Predicate &predicate) const {
+            const google::protobuf::Message *msg = &root;
+            for (size_t i = 0; i + 1 < predicate.path.size(); i++) {
+                msg = &msg->GetReflection()->GetMessage(*msg, predicate.path[i]);
+            }
+            const google::protobuf::FieldDescriptor *leaf = predicate.path.back();
+            const google::protobuf::Reflection *reflection = msg->GetReflection();
+            /* repeated fields match when any element does */
+            int count = leaf->is_repeated() ? reflection->FieldSize(*msg, leaf) : 1;
+            for (int i = 0; i < count; i++) {
+                int index = leaf->is_repeated() ? i : -1;
+                bool ret;
+                if (predicate.numeric) {
+                    ret = compare(number(*msg, leaf, index), predicate.op, predicate.number);
+                }
+                else {
+                    std::string text = leaf->is_repeated() ? reflection->GetRepeatedString(*msg, leaf, i) : reflection->GetString(*msg, leaf);
+                    ret = compare(text, predicate.op, predicate.text);
+                }
+                if (ret) return true;
+            }
+            return false;
+        }
+        std::vector<Predicate> predicates;
+        std::string error_;
+    };
+}
+
+#endif
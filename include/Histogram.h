@@ -0,0 +1,56 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Call latencies in power of two buckets of microseconds: bucket 0 holds calls under 1 us, bucket i
+ * those from 2^(i-1) up to 2^i us. Recording is a couple of relaxed atomic adds, so every call can be
+ * recorded from any thread.
+ */
+namespace core {
+    class LatencyHistogram {
+        public:
+        static const int BUCKETS = 32;
+        void record(std::chrono::nanoseconds latency) {
+            uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+            int bucket = 0;
+            while (us > 0 && bucket < BUCKETS - 1) {
+                us >>= 1;
+                bucket++;
+            }
+            this->counts[bucket].fetch_add(1, std::memory_order_relaxed);
+            this->total.fetch_add(1, std::memory_order_relaxed);
+        }
+        uint64_t count() const {
+            return this->total.load(std::memory_order_relaxed);
+        }
+        std::vector<uint64_t> buckets() const {
+            std::vector<uint64_t> counts(BUCKETS);
+            for (int i = 0; i < BUCKETS; i++) counts[i] = this->counts[i].load(std::memory_order_relaxed);
+            return counts;
+        }
+        /* upper bound of the bucket the p quantile (0 to 1) falls into, zero before the first call */
+        std::chrono::microseconds percentile(double p) const {
+            std::vector<uint64_t> counts = this->buckets();
+            uint64_t total = 0;
+            for (uint64_t count : counts) total += count;
+            if (total == 0) return std::chrono::microseconds(0);
+            uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= rank) return std::chrono::microseconds(1ull << i);
+            }
+            return std::chrono::microseconds(1ull << (BUCKETS - 1));
+        }
+        private:
+        std::atomic<uint64_t> counts[BUCKETS] = {};
+        std::atomic<uint64_t> total{0};
+    };
+}
+
+#endif
@@ -0,0 +1,437 @@
+#ifndef LINK_H
+#define LINK_H
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TCPSocket.h"
+#include "connection.pb.h"
+
+/*
+ * One multiplexed data link per pair of nodes.
+ * The subscribing node owns a single tcp + unix acceptor and hands out a topic id per Subscriber,
+ * the publishing node keeps one OutLink (socket + sender thread) per remote node and tags every
+ * frame with the topic id the remote side asked for.
+ * Flow control runs the other way on the same socket: the subscriber grants credits per topic id
+ * as it consumes frames, a channel without credits keeps (and drops/conflates) frames at the
+ * publisher instead of filling the socket and stalling the other topics on the link.
+ */
+namespace core {
+    using Frame = std::shared_ptr<const std::string>;
+    class InLink;
+    using FrameSink = std::function<void(const char *data, uint32_t size, const std::shared_ptr<InLink> &link)>;
+    class OutLink;
+    /*
+     * the (topic, remote subscriber) pair of a Publisher on an OutLink.
+     * With a rate the channel is decimated at the publisher: at most one frame per 1/rate seconds,
+     * always the newest one. Without a rate (<= 0) up to maxSize frames wait for credits and a full
+     * queue is handled by the subscriber's FlowControl policy. push() never waits: under BLOCK a frame
+     * that finds the queue full is queued anyway and dropped by the sender once it waited block_timeout.
+     */
+    class OutChannel {
+        public:
+        OutChannel(std::shared_ptr<OutLink> link, uint32_t topic_id, float rate, int maxSize, const FlowControl &flow) :
+            link_(link), topic_id(topic_id), period(rate > 0 ? std::chrono::microseconds((int64_t)(1e6 / rate)) : std::chrono::microseconds(0)),
+            maxSize((size_t)std::max(maxSize, 1)), policy(flow.policy()), block_timeout(flow.block_timeout_ms()),
+            flow_controlled(flow.credits() > 0), credits(flow.credits()), next_send(std::chrono::steady_clock::now()), sending(false), closed(false) {}
+        /* queue a frame for sending, false once the link is gone */
+        bool push(Frame frame);
+        /* true once every queued frame was written to the socket (or dropped), false if deadline passed first */
+        bool drain(std::chrono::steady_clock::time_point deadline);
+        /* drops the queued frames and takes the channel off its link, push() fails from then on */
+        void close();
+        private:
+        friend class OutLink;
+        using Clock = std::chrono::steady_clock;
+        struct Queued {
+            Frame frame;
+            Clock::time_point expiry;
+        };
+        /* drop BLOCK frames that waited past their timeout for room in the queue, called with the link mutex held */
+        void expire(Clock::time_point now) {
+            if (this->policy != FlowControl::BLOCK || this->frames.size() <= this->maxSize) return;
+            this->frames.erase(std::remove_if(this->frames.begin() + this->maxSize, this->frames.end(), [now](const Queued &queued) {
+                return queued.expiry <= now;
+            }), this->frames.end());
+        }
+        std::shared_ptr<OutLink> link_;
+        uint32_t topic_id;
+        std::chrono::microseconds period;
+        size_t maxSize;
+        FlowControl::Policy policy;
+        std::chrono::milliseconds block_timeout;
+        bool flow_controlled;
+        int64_t credits;
+        std::deque<Queued> frames;
+        std::chrono::steady_clock::time_point next_send;
+        bool sending;
+        bool closed;
+    };
+    class OutLink : public std::enable_shared_from_this<OutLink> {
+        public:
+        OutLink(std::shared_ptr<ClientSocket> c_sock) : c_sock(c_sock), alive_(true), next_(0) {}
+        ~OutLink() {
+            this->c_sock->disconnect();
+        }
+        void start() {
+            std::shared_ptr<OutLink> self = shared_from_this();
+            std::thread send_thread_ = std::thread([self]() {
+                self->send_loop();
+            });
+            send_thread_.detach();
+            std::thread credit_thread_ = std::thread([self]() {
+                self->credit_loop();
+            });
+            credit_thread_.detach();
+        }
+        std::shared_ptr<OutChannel> add_channel(uint32_t topic_id, float rate, int maxSize, const FlowControl &flow) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            for (auto &channel : this->channels) {
+                if (channel->topic_id == topic_id) return channel;
+            }
+            std::shared_ptr<OutChannel> channel = std::make_shared<OutChannel>(shared_from_this(), topic_id, rate, maxSize, flow);
+            this->channels.push_back(channel);
+            return channel;
+        }
+        bool alive() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->alive_;
+        }
+        private:
+        friend class OutChannel;
+        friend class LinkManager;
+        void send_loop() {
+            while (1) {
+                std::shared_ptr<OutChannel> channel;
+                Frame frame;
+                bool drained;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex_);
+                    std::chrono::steady_clock::time_point now;
+                    while (!channel && this->alive_) {
+                        now = std::chrono::steady_clock::now();
+                        auto wake = std::chrono::steady_clock::time_point::max();
+                        /* round robin over the channels so one busy topic cannot starve the others */
+                        for (size_t i = 0; i < this->channels.size(); i++) {
+                            std::shared_ptr<OutChannel> &candidate = this->channels[(this->next_ + i) % this->channels.size()];
+                            candidate->expire(now);
+                            if (candidate->frames.empty()) continue;
+                            /* out of credits, wait for the subscriber to catch up (credit_loop wakes us) */
+                            if (candidate->flow_controlled && candidate->credits <= 0) continue;
+                            if (candidate->next_send <= now) {
+                                channel = candidate;
+                                this->next_ = (this->next_ + i + 1) % this->channels.size();
+                                break;
+                            }
+                            wake = std::min(wake, candidate->next_send);
+                        }
+                        if (channel) break;
+                        if (wake == std::chrono::steady_clock::time_point::max()) this->cv_.wait(lock);
+                        else this->cv_.wait_until(lock, wake);
+                    }
+                    if (!channel) break;
+                    frame = channel->frames.front().frame;
+                    channel->frames.pop_front();
+                    if (channel->flow_controlled) channel->credits--;
+                    if (channel->next_send + channel->period < now) channel->next_send = now + channel->period;
+                    else channel->next_send += channel->period;
+                    /* the last queued frame counts as queued until it is written, see drain() */
+                    drained = channel->frames.empty();
+                    channel->sending = drained;
+                }
+                if (!this->c_sock->SendFrame(channel->topic_id, *frame)) break;
+                if (drained) {
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex_);
+                        channel->sending = false;
+                    }
+                    this->drained_cv_.notify_all();
+                }
+            }
+            this->close();
+        }
+        /* credit frames from the subscriber: [4][topic id][granted : le32] */
+        void credit_loop() {
+            std::vector<char> payload;
+            while (1) {
+                uint32_t topic_id;
+                if (!this->c_sock->ReadFrame(topic_id, payload) || payload.size() < 4) break;
+                google::protobuf::uint32 granted;
+                google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray((const uint8_t*)payload.data(), &granted);
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    for (auto &channel : this->channels) {
+                        if (channel->topic_id == topic_id) channel->credits += granted;
+                    }
+                }
+                this->cv_.notify_one();
+            }
+            this->close();
+        }
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (!this->alive_) return;
+                this->alive_ = false;
+                for (auto &channel : this->channels) {
+                    channel->closed = true;
+                    channel->frames.clear();
+                }
+                /* the publishers drop their channels (and with them this link) on the next push */
+                this->channels.clear();
+            }
+            /* wake the other thread, the socket itself is closed with the last reference */
+            this->c_sock->Shutdown();
+            this->cv_.notify_all();
+            this->drained_cv_.notify_all();
+        }
+        std::shared_ptr<ClientSocket> c_sock;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::condition_variable drained_cv_;
+        std::vector<std::shared_ptr<OutChannel> > channels;
+        bool alive_;
+        size_t next_;
+    };
+    inline bool OutChannel::push(Frame frame) {
+        {
+            std::lock_guard<std::mutex> lock(this->link_->mutex_);
+            if (this->closed) return false;
+            Clock::time_point expiry = Clock::time_point::max();
+            /* rate limited subscriber: only the newest sample waits for the next send slot */
+            if (this->period.count() > 0 || this->policy == FlowControl::CONFLATE) this->frames.clear();
+            else if (this->frames.size() >= this->maxSize) {
+                switch (this->policy) {
+                    case FlowControl::DROP_NEWEST:
+                        return true;
+                    case FlowControl::BLOCK:
+                        /* over the queue size the frame only waits block_timeout for credits */
+                        expiry = Clock::now() + this->block_timeout;
+                        this->expire(Clock::now());
+                        break;
+                    default:
+                        this->frames.pop_front();
+                        break;
+                }
+            }
+            this->frames.push_back({frame, expiry});
+        }
+        this->link_->cv_.notify_one();
+        return true;
+    }
+    inline void OutChannel::close() {
+        {
+            std::lock_guard<std::mutex> lock(this->link_->mutex_);
+            if (this->closed) return;
+            this->closed = true;
+            this->frames.clear();
+            std::vector<std::shared_ptr<OutChannel> > &channels = this->link_->channels;
+            channels.erase(std::remove_if(channels.begin(), channels.end(), [this](const std::shared_ptr<OutChannel> &channel) {
+                return channel.get() == this;
+            }), channels.end());
+        }
+        this->link_->drained_cv_.notify_all();
+    }
+    inline bool OutChannel::drain(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(this->link_->mutex_);
+        return this->link_->drained_cv_.wait_until(lock, deadline, [this]() {
+            return this->closed || (this->frames.empty() && !this->sending);
+        });
+    }
+    /*
+     * the receiving end of a link. Subscribers report every frame they are done with (consumed or
+     * dropped) and credits go back to the publisher in batches of half the window.
+     */
+    class InLink {
+        public:
+        InLink(int sock) : srv_sock(sock), closed(false) {}
+        void consumed(uint32_t topic_id, uint32_t window) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->closed || window == 0) return;
+            uint32_t &count = this->pending[topic_id];
+            if (++count < std::max(window / 2, (uint32_t)1)) return;
+            std::string payload(4, 0);
+            google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(count, (uint8_t*)&payload[0]);
+            count = 0;
+            this->srv_sock.SendFrame(topic_id, payload);
+        }
+        private:
+        friend class LinkManager;
+        void disconnect() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->closed = true;
+            this->srv_sock.disconnect();
+        }
+        /* ends the receive loop reading from the socket */
+        void shutdown() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (!this->closed) this->srv_sock.Shutdown();
+        }
+        ServerSocket srv_sock;
+        std::mutex mutex_;
+        bool closed;
+        std::unordered_map<uint32_t, uint32_t> pending;
+    };
+    class LinkManager {
+        public:
+        LinkManager(std::string ip) : ip(ip), tcp_port(0), next_topic_id(1), stopped(false) {
+            bool ret = false;
+            tcp_acceptor = AcceptorSocket(this->ip, this->tcp_port, ret);
+            if (ret) {
+                this->acceptors.push_back(&this->tcp_acceptor);
+                this->acceptor_threads.emplace_back([this]() {
+                    this->accept_loop(this->tcp_acceptor);
+                });
+            }
+            ret = false;
+            uds_acceptor = AcceptorSocket(this->uds_path, ret);
+            if (ret) {
+                this->acceptors.push_back(&this->uds_acceptor);
+                this->acceptor_threads.emplace_back([this]() {
+                    this->accept_loop(this->uds_acceptor);
+                });
+            }
+            else this->uds_path = "";
+        }
+        /* stops accepting, ends every receive loop and closes the outgoing links */
+        ~LinkManager() {
+            {
+                std::lock_guard<std::mutex> lock(this->threads_mutex_);
+                this->stopped = true;
+                for (Receiver &receiver : this->receivers) receiver.link->shutdown();
+            }
+            for (AcceptorSocket *acceptor : this->acceptors) acceptor->Shutdown();
+            for (std::thread &thread : this->acceptor_threads) thread.join();
+            /* no receiver is added any more, the list only changes under us through finished flags */
+            for (Receiver &receiver : this->receivers) receiver.thread.join();
+            for (AcceptorSocket *acceptor : this->acceptors) acceptor->disconnect();
+            std::lock_guard<std::mutex> lock(this->links_mutex_);
+            for (auto &pair : this->out_links) pair.second->close();
+        }
+        /* register the receiving end of a subscription, returns the topic id carried by its frames */
+        uint32_t add_sink(FrameSink sink) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            uint32_t topic_id = this->next_topic_id++;
+            this->sinks[topic_id] = std::make_shared<FrameSink>(sink);
+            return topic_id;
+        }
+        /* the shared link towards a remote node, connected on first use.
+           The connect runs without links_mutex_, a slow peer does not hold up the links to the others */
+        std::shared_ptr<OutLink> link_to(std::string ip, uint32_t port, std::string uds_path) {
+            bool use_uds = !uds_path.empty();
+            std::string key = use_uds ? "unix:" + uds_path : ip + ":" + std::to_string(port);
+            {
+                std::lock_guard<std::mutex> lock(this->links_mutex_);
+                auto iter = this->out_links.find(key);
+                if (iter != this->out_links.end()) {
+                    if (iter->second->alive()) return iter->second;
+                    this->out_links.erase(iter);
+                }
+            }
+            bool ret = false;
+            std::shared_ptr<ClientSocket> c_sock = std::make_shared<ClientSocket>(ret, use_uds ? AF_UNIX : AF_INET);
+            if (!ret) return nullptr;
+            ret = use_uds ? c_sock->Connect(uds_path) : c_sock->Connect(ip, port);
+            if (!ret) {
+                c_sock->disconnect();
+                return nullptr;
+            }
+            std::shared_ptr<OutLink> link;
+            bool ours = false;
+            {
+                std::lock_guard<std::mutex> lock(this->links_mutex_);
+                auto iter = this->out_links.find(key);
+                /* another topic connected to the same node meanwhile, keep its link and drop ours */
+                if (iter != this->out_links.end() && iter->second->alive()) link = iter->second;
+                else {
+                    link = std::make_shared<OutLink>(c_sock);
+                    this->out_links[key] = link;
+                    ours = true;
+                }
+            }
+            if (!ours) {
+                c_sock->disconnect();
+                return link;
+            }
+            std::cout << "Successful Connected link to " << ip << ":" << port << (use_uds ? " (unix socket)" : "") << "\n";
+            link->start();
+            return link;
+        }
+        std::string ip;
+        uint32_t tcp_port;
+        std::string uds_path;
+        private:
+        struct Receiver {
+            std::shared_ptr<InLink> link;
+            std::thread thread;
+            bool finished = false;
+        };
+        void accept_loop(AcceptorSocket &acceptor) {
+            while (1) {
+                int sock;
+                bool accepted = acceptor.Accept(sock);
+                std::lock_guard<std::mutex> lock(this->threads_mutex_);
+                if (this->stopped) {
+                    if (accepted) close(sock);
+                    return;
+                }
+                if (!accepted) continue;
+                /* join the receive threads of the links that closed since */
+                for (auto iter = this->receivers.begin(); iter != this->receivers.end();) {
+                    if (!iter->finished) {
+                        iter++;
+                        continue;
+                    }
+                    iter->thread.join();
+                    iter = this->receivers.erase(iter);
+                }
+                std::list<Receiver>::iterator receiver = this->receivers.emplace(this->receivers.end());
+                receiver->link = std::make_shared<InLink>(sock);
+                receiver->thread = std::thread([this, receiver]() {
+                    this->receive_loop(receiver->link);
+                    std::lock_guard<std::mutex> lock(this->threads_mutex_);
+                    receiver->finished = true;
+                });
+            }
+        }
+        void receive_loop(std::shared_ptr<InLink> link) {
+            std::vector<char> payload;
+            std::cout << "Successful Connected link as subscriber " << this->ip << ":" << this->tcp_port << "\n";
+            while (1) {
+                uint32_t topic_id;
+                if (!link->srv_sock.ReadFrame(topic_id, payload)) break;
+                std::shared_ptr<FrameSink> sink;
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    auto iter = this->sinks.find(topic_id);
+                    if (iter != this->sinks.end()) sink = iter->second;
+                }
+                if (sink) (*sink)(payload.data(), payload.size(), link);
+            }
+            link->disconnect();
+        }
+        AcceptorSocket tcp_acceptor;
+        AcceptorSocket uds_acceptor;
+        std::mutex mutex_;
+        std::mutex links_mutex_;
+        uint32_t next_topic_id;
+        std::unordered_map<uint32_t, std::shared_ptr<FrameSink> > sinks;
+        std::unordered_map<std::string, std::shared_ptr<OutLink> > out_links;
+        std::mutex threads_mutex_;
+        bool stopped;
+        std::vector<AcceptorSocket *> acceptors;
+        std::vector<std::thread> acceptor_threads;
+        std::list<Receiver> receivers;
+    };
+}
+
+#endif
@@ -8,121 +8,818 @@
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
 #include <mutex>
 #include <thread>
-#include <condition_variable>
+#include <unistd.h>
 
 #include "registration.grpc.pb.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
 using grpc::Status;
 
 namespace core {
-    class RegistrationServiceImpl final : public Registration::Service {
+    /*
+     * who publishes, subscribes, serves and calls what, as seen by the master.
+     * Every change bumps the version. The Graph message is built outside the lock from a copy-on-write
+     * state, only for versions somebody asks for (changes made while every watcher is still writing
+     * are not built one by one), and the same snapshot is shared by every GetGraph/WatchGraph caller.
+     */
+    class MasterGraph {
         public:
-        Status Subscribe(ServerContext* context, const SubscribeRequest* request,
-                          grpc::ServerWriter<SubscribeReply>* writer) override {
-            std::cout << "receive subscriber\n";
-            const std::string topic_name = request->topic_name();
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                receive_topic = topic_name;
-                receive_ip = request->endpoint().ip();
-                receive_port = request->endpoint().port();
-            }
-            subscribe_condition_.notify_all();
-            while (1) {
-                std::unique_lock<std::mutex> lock(mutex_);
-                publish_condition_.wait(lock);
-                std::cout << "publisher condition unlock\n";
-                if (topic_name != receive_topic) continue;
-                SubscribeReply reply;
-                reply.set_topic_name(topic_name);
-                EndPoint* endpoint = reply.mutable_endpoint();
-                endpoint->set_ip(receive_ip);
-                endpoint->set_port(receive_port);
-                if (!writer->Write(reply)) break;
-            }
-            std::cout << "A subscriber died\n";
-            return Status::OK;
-        }
-        Status Publish(ServerContext* context, const PublishRequest* request,
-                          grpc::ServerWriter<PublishReply>* writer) override {
-            std::cout << "receive publisher\n";
-            const std::string topic_name = request->topic_name();
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                receive_topic = topic_name;
-                receive_ip = request->endpoint().ip();
-                receive_port = request->endpoint().port();
-            }
-            publish_condition_.notify_all();
-            while (1) {
-                std::unique_lock<std::mutex> lock(mutex_);
-                subscribe_condition_.wait(lock);
-                std::cout << "subscriber condition unlock\n";
-                if (topic_name != receive_topic) continue;
-                PublishReply reply;
-                reply.set_topic_name(topic_name);
-                EndPoint* endpoint = reply.mutable_endpoint();
-                endpoint->set_ip(receive_ip);
-                endpoint->set_port(receive_port);
-                if (!writer->Write(reply)) break;
-            }
-            std::cout << "A subscriber died\n";
-            return Status::OK;
-        }
-        Status ServiceServers(ServerContext* context, const ServiceServerRequest* request,
-                          ServiceServerReply *reply) override {
+        class Listener {
+            public:
+            virtual ~Listener() {}
+            /* called with the graph locked: true to be handed the new snapshot now, false while still busy */
+            virtual bool ready() = 0;
+            /* called without the lock, only after ready() returned true */
+            virtual void update(const std::shared_ptr<const Graph> &snapshot) = 0;
+        };
+        MasterGraph() : version(0), state(std::make_shared<State>()) {}
+        void add_publisher(const std::string &topic, const std::string &type_name, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                Topic &entry = this->writable().topics[topic];
+                if (!type_name.empty()) entry.type_name = type_name;
+                add(entry.publishers, endpoint);
+                this->changed();
+            }
+            this->publish();
+        }
+        void remove_publisher(const std::string &topic, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                remove(this->writable().topics[topic].publishers, endpoint);
+                this->prune_topic(topic);
+                this->changed();
+            }
+            this->publish();
+        }
+        void add_subscriber(const std::string &topic, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                add(this->writable().topics[topic].subscribers, endpoint);
+                this->changed();
+            }
+            this->publish();
+        }
+        void remove_subscriber(const std::string &topic, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                remove(this->writable().topics[topic].subscribers, endpoint);
+                this->prune_topic(topic);
+                this->changed();
+            }
+            this->publish();
+        }
+        void add_service_server(const std::string &service, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                add(this->writable().services[service].servers, endpoint);
+                this->changed();
+            }
+            this->publish();
+        }
+        void remove_service_server(const std::string &service, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                auto found = this->state->services.find(service);
+                if (found == this->state->services.end() || found->second.servers.count(key(endpoint)) == 0) return;
+                std::map<std::string, Service> &services = this->writable().services;
+                auto iter = services.find(service);
+                /* the registry keeps one entry per node, so does the graph */
+                iter->second.servers.erase(key(endpoint));
+                if (iter->second.servers.empty() && iter->second.clients.empty()) services.erase(iter);
+                this->changed();
+            }
+            this->publish();
+        }
+        void add_service_client(const std::string &service, const EndPoint &endpoint) {
             {
-                std::lock_guard<std::mutex> lock(service_mutex_);
-                service_servers[request->service_name()] = std::pair<std::string, uint32_t>(request->endpoint().ip(), request->endpoint().port());
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                add(this->writable().services[service].clients, endpoint);
+                this->changed();
             }
-            service_condition_.notify_all();
-            return Status::OK;
+            this->publish();
         }
-        Status ServiceClients(ServerContext* context, const ServiceClientRequest* request,
-                          grpc::ServerWriter<ServiceClientReply>* writer) override {
+        void remove_service_client(const std::string &service, const EndPoint &endpoint) {
             {
-                ServiceClientReply reply;
-                std::unique_lock<std::mutex> lock(service_mutex_);
-                auto iter = service_servers.find(request->service_name());
-                if ( iter != service_servers.end()) {
-                    core::EndPoint* endpoint = reply.mutable_endpoint();
-                    endpoint->set_ip(iter->second.first);
-                    endpoint->set_port(iter->second.second);
-                    writer->Write(reply);
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                std::map<std::string, Service> &services = this->writable().services;
+                Service &entry = services[service];
+                remove(entry.clients, endpoint);
+                if (entry.servers.empty() && entry.clients.empty()) services.erase(service);
+                this->changed();
+            }
+            this->publish();
+        }
+        std::shared_ptr<const Graph> snapshot() {
+            std::shared_ptr<const State> current;
+            uint64_t version;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->cached) return this->cached;
+                current = this->state;
+                version = this->version;
+            }
+            std::shared_ptr<const Graph> graph = build(*current, version);
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->version != version) return graph;
+            /* another caller may have built the same version meanwhile, everyone shares the first one */
+            if (!this->cached) this->cached = graph;
+            return this->cached;
+        }
+        /* the listener gets the current snapshot, then one after every change it is ready for */
+        void watch(Listener *listener) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->listeners.push_back(listener);
+                if (!listener->ready()) return;
+            }
+            listener->update(this->snapshot());
+        }
+        void unwatch(Listener *listener) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->listeners.erase(std::remove(this->listeners.begin(), this->listeners.end(), listener), this->listeners.end());
+        }
+        static std::string key(const EndPoint &endpoint) {
+            return endpoint.ip() + ":" + std::to_string(endpoint.port());
+        }
+        private:
+        /* endpoint "ip:port" -> (endpoint, registrations), a node may register the same name twice */
+        using Endpoints = std::map<std::string, std::pair<EndPoint, int> >;
+        struct Topic {
+            std::string type_name;
+            Endpoints publishers;
+            Endpoints subscribers;
+        };
+        struct Service {
+            Endpoints servers;
+            Endpoints clients;
+        };
+        struct State {
+            std::map<std::string, Topic> topics;
+            std::map<std::string, Service> services;
+        };
+        static void add(Endpoints &endpoints, const EndPoint &endpoint) {
+            std::pair<EndPoint, int> &entry = endpoints[key(endpoint)];
+            entry.first = endpoint;
+            entry.second++;
+        }
+        static void remove(Endpoints &endpoints, const EndPoint &endpoint) {
+            auto iter = endpoints.find(key(endpoint));
+            if (iter == endpoints.end()) return;
+            if (--iter->second.second <= 0) endpoints.erase(iter);
+        }
+        /* the state to change, copied first while a snapshot is still being built from it */
+        State &writable() {
+            if (this->state.use_count() > 1) this->state = std::make_shared<State>(*this->state);
+            return *this->state;
+        }
+        void prune_topic(const std::string &topic) {
+            std::map<std::string, Topic> &topics = this->writable().topics;
+            auto iter = topics.find(topic);
+            if (iter != topics.end() && iter->second.publishers.empty() && iter->second.subscribers.empty()) topics.erase(iter);
+        }
+        void changed() {
+            this->version++;
+            this->cached.reset();
+        }
+        /* hands the new version to the listeners that are ready, the busy ones fetch the newest
+           snapshot when they are done, so nothing is built while every watcher is still writing */
+        void publish() {
+            std::vector<Listener*> ready;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                for (Listener *listener : this->listeners) {
+                    if (listener->ready()) ready.push_back(listener);
+                }
+            }
+            if (ready.empty()) return;
+            std::shared_ptr<const Graph> graph = this->snapshot();
+            /* a listener that returned ready() stays alive until its update was written */
+            for (Listener *listener : ready) listener->update(graph);
+        }
+        static std::shared_ptr<const Graph> build(const State &state, uint64_t version) {
+            std::shared_ptr<Graph> graph = std::make_shared<Graph>();
+            graph->set_version(version);
+            std::map<std::string, GraphNode> nodes;
+            auto node = [&nodes](const EndPoint &endpoint) -> GraphNode& {
+                GraphNode &entry = nodes[key(endpoint)];
+                *entry.mutable_endpoint() = endpoint;
+                return entry;
+            };
+            for (auto &pair : state.topics) {
+                GraphTopic *topic = graph->add_topics();
+                topic->set_topic_name(pair.first);
+                topic->set_type_name(pair.second.type_name);
+                for (auto &endpoint : pair.second.publishers) {
+                    *topic->add_publishers() = endpoint.second.first;
+                    node(endpoint.second.first).add_publishes(pair.first);
+                }
+                for (auto &endpoint : pair.second.subscribers) {
+                    *topic->add_subscribers() = endpoint.second.first;
+                    node(endpoint.second.first).add_subscribes(pair.first);
                 }
             }
-            while (1) {
-                std::unique_lock<std::mutex> lock(mutex_);
-                service_condition_.wait(lock);
-                {
-                    ServiceClientReply reply;
-                    std::lock_guard<std::mutex> lock(service_mutex_);
-                    auto iter = service_servers.find(request->service_name());
-                    if ( iter != service_servers.end()) {
-                        core::EndPoint* endpoint = reply.mutable_endpoint();
-                        endpoint->set_ip(iter->second.first);
-                        endpoint->set_port(iter->second.second);
-                        writer->Write(reply);
+            for (auto &pair : state.services) {
+                GraphService *service = graph->add_services();
+                service->set_service_name(pair.first);
+                for (auto &endpoint : pair.second.servers) {
+                    *service->add_servers() = endpoint.second.first;
+                    node(endpoint.second.first).add_serves(pair.first);
+                }
+                if (!pair.second.servers.empty()) *service->mutable_server() = pair.second.servers.begin()->second.first;
+                for (auto &endpoint : pair.second.clients) {
+                    *service->add_clients() = endpoint.second.first;
+                    node(endpoint.second.first).add_calls(pair.first);
+                }
+            }
+            for (auto &pair : nodes) *graph->add_nodes() = pair.second;
+            return graph;
+        }
+        std::mutex mutex_;
+        std::vector<Listener*> listeners;
+        uint64_t version;
+        std::shared_ptr<const Graph> cached;
+        std::shared_ptr<State> state;
+    };
+    /* a master side registration stream, told about new peers of its topic or service */
+    class RegistrationWatcher {
+        public:
+        virtual ~RegistrationWatcher() {}
+        virtual void notify(const EndPoint &endpoint) = 0;
+        /* the node that registered, and ending the stream when that node is evicted */
+        virtual const EndPoint &node() const = 0;
+        virtual void close() = 0;
+    };
+    /* ends the streams of an evicted node, with the registry locked so none of them is gone meanwhile */
+    inline void closeWatchers(std::vector<RegistrationWatcher*> &watchers, const std::string &node) {
+        for (RegistrationWatcher *watcher : watchers) {
+            if (MasterGraph::key(watcher->node()) == node) watcher->close();
+        }
+    }
+    /*
+     * publisher and subscriber streams by topic. A new subscriber is announced only to the publishers
+     * of its topic and vice versa, so a registration reaches just the streams that care; each stream
+     * queues what it is told, so registrations arriving back to back are never lost.
+     */
+    class TopicRegistry {
+        public:
+        void add_publisher(const std::string &topic, RegistrationWatcher *watcher, const EndPoint &endpoint) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            Topic &entry = this->topics[topic];
+            add(entry.publishers, entry.subscribers, watcher, endpoint);
+        }
+        void add_subscriber(const std::string &topic, RegistrationWatcher *watcher, const EndPoint &endpoint) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            Topic &entry = this->topics[topic];
+            add(entry.subscribers, entry.publishers, watcher, endpoint);
+        }
+        /* once these return the watcher is never notified again */
+        void remove_publisher(const std::string &topic, RegistrationWatcher *watcher) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->remove(topic, this->topics[topic].publishers, watcher);
+        }
+        void remove_subscriber(const std::string &topic, RegistrationWatcher *watcher) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->remove(topic, this->topics[topic].subscribers, watcher);
+        }
+        void evict(const std::string &node) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            for (auto &pair : this->topics) {
+                closeWatchers(pair.second.publishers, node);
+                closeWatchers(pair.second.subscribers, node);
+            }
+        }
+        private:
+        struct Topic {
+            std::vector<RegistrationWatcher*> publishers;
+            std::vector<RegistrationWatcher*> subscribers;
+        };
+        /* the newcomer is announced to the other side of its topic only */
+        static void add(std::vector<RegistrationWatcher*> &own, std::vector<RegistrationWatcher*> &others, RegistrationWatcher *watcher, const EndPoint &endpoint) {
+            own.push_back(watcher);
+            for (RegistrationWatcher *other : others) other->notify(endpoint);
+        }
+        void remove(const std::string &topic, std::vector<RegistrationWatcher*> &watchers, RegistrationWatcher *watcher) {
+            watchers.erase(std::remove(watchers.begin(), watchers.end(), watcher), watchers.end());
+            Topic &entry = this->topics[topic];
+            if (entry.publishers.empty() && entry.subscribers.empty()) this->topics.erase(topic);
+        }
+        std::mutex mutex_;
+        std::unordered_map<std::string, Topic> topics;
+    };
+    /*
+     * every server of a service by name and the client streams waiting for them. Clients are told
+     * about each server and balance their calls over all of them; servers leave with their node.
+     */
+    class ServiceRegistry {
+        public:
+        /* owner is the registration the server came with, if it goes away with it */
+        void add_server(const std::string &service, const EndPoint &endpoint, RegistrationWatcher *owner = nullptr) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::vector<Server> &servers = this->servers[service];
+            /* the same node registering again (a new stream after a reconnect) takes over its entry */
+            auto iter = std::find_if(servers.begin(), servers.end(), [&](const Server &server) {
+                return MasterGraph::key(server.endpoint) == MasterGraph::key(endpoint);
+            });
+            if (iter != servers.end()) iter->owner = owner;
+            else servers.push_back(Server{endpoint, owner});
+            for (RegistrationWatcher *client : this->clients[service]) client->notify(endpoint);
+        }
+        /* false if another registration took over the server meanwhile */
+        bool remove_server(const std::string &service, RegistrationWatcher *owner) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            auto entry = this->servers.find(service);
+            if (entry == this->servers.end()) return false;
+            std::vector<Server> &servers = entry->second;
+            auto iter = std::find_if(servers.begin(), servers.end(), [&](const Server &server) { return server.owner == owner; });
+            if (iter == servers.end()) return false;
+            servers.erase(iter);
+            if (servers.empty()) this->servers.erase(entry);
+            return true;
+        }
+        /* a client learns the current servers right away */
+        void add_client(const std::string &service, RegistrationWatcher *watcher) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->clients[service].push_back(watcher);
+            auto iter = this->servers.find(service);
+            if (iter == this->servers.end()) return;
+            for (const Server &server : iter->second) watcher->notify(server.endpoint);
+        }
+        void remove_client(const std::string &service, RegistrationWatcher *watcher) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::vector<RegistrationWatcher*> &watchers = this->clients[service];
+            watchers.erase(std::remove(watchers.begin(), watchers.end(), watcher), watchers.end());
+            if (watchers.empty()) this->clients.erase(service);
+        }
+        /* drops the services the node served, new clients are no longer sent there; returns their names */
+        std::vector<std::string> evict(const std::string &node) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::vector<std::string> served;
+            for (auto entry = this->servers.begin(); entry != this->servers.end();) {
+                std::vector<Server> &servers = entry->second;
+                for (auto iter = servers.begin(); iter != servers.end();) {
+                    if (MasterGraph::key(iter->endpoint) != node) {
+                        iter++;
+                        continue;
                     }
+                    served.push_back(entry->first);
+                    if (iter->owner) iter->owner->close();
+                    iter = servers.erase(iter);
+                }
+                if (servers.empty()) entry = this->servers.erase(entry);
+                else entry++;
+            }
+            for (auto &pair : this->clients) closeWatchers(pair.second, node);
+            return served;
+        }
+        private:
+        struct Server {
+            EndPoint endpoint;
+            RegistrationWatcher *owner;
+        };
+        std::mutex mutex_;
+        std::unordered_map<std::string, std::vector<Server> > servers;
+        std::unordered_map<std::string, std::vector<RegistrationWatcher*> > clients;
+    };
+    /*
+     * server streaming call on the callback API: no thread is parked per stream, writes are issued
+     * one at a time from whichever thread has something to send. Finish is called once, after the
+     * last write completed, when the client went away or a write failed.
+     */
+    template<class Reply, class Base = grpc::ServerWriteReactor<Reply> >
+    class StreamReactor : public Base {
+        public:
+        void OnCancel() override {
+            this->close_stream();
+        }
+        /* finishes once the write in progress, if any, completed */
+        void close_stream() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->done = true;
+                if (this->writing) return;
+            }
+            this->finish();
+        }
+        protected:
+        /* after a write completed, with mutex_ held: false once the stream is done */
+        bool write_done(bool ok) {
+            if (!ok) this->done = true;
+            return !this->done;
+        }
+        void finish() {
+            if (this->finished.exchange(true)) return;
+            this->Finish(Status::OK);
+        }
+        std::mutex mutex_;
+        bool writing = false;
+        bool done = false;
+        std::atomic<bool> finished{false};
+    };
+    /* writes every reply in order */
+    template<class Reply, class Base = grpc::ServerWriteReactor<Reply> >
+    class QueuedStream : public StreamReactor<Reply, Base> {
+        public:
+        void write(const Reply &reply) {
+            const Reply *next;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->done) return;
+                this->replies.push_back(reply);
+                if (this->writing) return;
+                this->writing = true;
+                next = &this->replies.front();
+            }
+            this->StartWrite(next);
+        }
+        void OnWriteDone(bool ok) override {
+            const Reply *next = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->replies.pop_front();
+                if (this->write_done(ok) && !this->replies.empty()) next = &this->replies.front();
+                else this->writing = false;
+            }
+            if (next) this->StartWrite(next);
+            else if (this->done) this->finish();
+        }
+        private:
+        /* a deque keeps the reply being written in place while new ones are queued */
+        std::deque<Reply> replies;
+    };
+    /* Subscribe (told about publishers) and Publish (told about subscribers) streams */
+    template<class Reply>
+    class TopicStream final : public QueuedStream<Reply>, public RegistrationWatcher {
+        public:
+        TopicStream(TopicRegistry &registry, MasterGraph &graph, const std::string &topic, const std::string &type_name, const EndPoint &endpoint, bool publisher) :
+        registry(registry), graph(graph), topic(topic), endpoint(endpoint), publisher(publisher) {
+            if (publisher) {
+                this->graph.add_publisher(topic, type_name, endpoint);
+                this->registry.add_publisher(topic, this, endpoint);
+            }
+            else {
+                this->graph.add_subscriber(topic, endpoint);
+                this->registry.add_subscriber(topic, this, endpoint);
+            }
+        }
+        void notify(const EndPoint &peer) override {
+            Reply reply;
+            reply.set_topic_name(this->topic);
+            *reply.mutable_endpoint() = peer;
+            this->write(reply);
+        }
+        const EndPoint &node() const override { return this->endpoint; }
+        void close() override { this->close_stream(); }
+        void OnDone() override {
+            if (this->publisher) {
+                this->registry.remove_publisher(this->topic, this);
+                this->graph.remove_publisher(this->topic, this->endpoint);
+                std::cout << "A publisher died\n";
+            }
+            else {
+                this->registry.remove_subscriber(this->topic, this);
+                this->graph.remove_subscriber(this->topic, this->endpoint);
+                std::cout << "A subscriber died\n";
+            }
+            delete this;
+        }
+        private:
+        TopicRegistry &registry;
+        MasterGraph &graph;
+        std::string topic;
+        EndPoint endpoint;
+        bool publisher;
+    };
+    class ServiceClientStream final : public QueuedStream<ServiceClientReply>, public RegistrationWatcher {
+        public:
+        ServiceClientStream(ServiceRegistry &registry, MasterGraph &graph, const std::string &service, const EndPoint &endpoint) :
+        registry(registry), graph(graph), service(service), endpoint(endpoint) {
+            this->graph.add_service_client(service, endpoint);
+            this->registry.add_client(service, this);
+        }
+        void notify(const EndPoint &server) override {
+            ServiceClientReply reply;
+            *reply.mutable_endpoint() = server;
+            this->write(reply);
+        }
+        const EndPoint &node() const override { return this->endpoint; }
+        void close() override { this->close_stream(); }
+        void OnDone() override {
+            this->registry.remove_client(this->service, this);
+            this->graph.remove_service_client(this->service, this->endpoint);
+            delete this;
+        }
+        private:
+        ServiceRegistry &registry;
+        MasterGraph &graph;
+        std::string service;
+        EndPoint endpoint;
+    };
+    /*
+     * Register: everything one node publishes, subscribes, serves and calls, on a single stream and
+     * in batches. The peers of each entry come back as RegisterEvents, and the whole node is
+     * unregistered at once when the stream ends.
+     */
+    class NodeStream final : public QueuedStream<RegisterEvent, grpc::ServerBidiReactor<RegisterBatch, RegisterEvent> > {
+        public:
+        NodeStream(TopicRegistry &topics, ServiceRegistry &services, MasterGraph &graph) :
+        topics(topics), services(services), graph(graph), registered(false) {
+            this->StartRead(&this->batch);
+        }
+        void OnReadDone(bool ok) override {
+            if (!ok) {
+                this->close_stream();
+                return;
+            }
+            if (!this->registered) {
+                this->endpoint = this->batch.endpoint();
+                this->registered = true;
+            }
+            std::cout << "Register " << this->batch.entries_size() << " entries of " << MasterGraph::key(this->endpoint) << "\n";
+            for (const RegisterEntry &entry : this->batch.entries()) {
+                this->entries.emplace_back(new Entry(this, entry));
+                this->add(this->entries.back().get());
+            }
+            this->StartRead(&this->batch);
+        }
+        void OnDone() override {
+            for (auto &entry : this->entries) this->remove(entry.get());
+            if (this->registered) std::cout << "Unregistered " << MasterGraph::key(this->endpoint) << "\n";
+            delete this;
+        }
+        private:
+        /* one publisher, subscriber, server or client of the node */
+        class Entry final : public RegistrationWatcher {
+            public:
+            Entry(NodeStream *stream, const RegisterEntry &entry) : stream(stream), entry(entry) {}
+            void notify(const EndPoint &peer) override {
+                RegisterEvent event;
+                event.set_kind(this->entry.kind());
+                event.set_name(this->entry.name());
+                *event.mutable_endpoint() = peer;
+                this->stream->write(event);
+            }
+            const EndPoint &node() const override { return this->stream->endpoint; }
+            void close() override { this->stream->close_stream(); }
+            NodeStream *stream;
+            RegisterEntry entry;
+        };
+        void add(Entry *entry) {
+            const std::string &name = entry->entry.name();
+            switch (entry->entry.kind()) {
+                case RegisterEntry::PUBLISHER:
+                    this->graph.add_publisher(name, entry->entry.type_name(), this->endpoint);
+                    this->topics.add_publisher(name, entry, this->endpoint);
+                    break;
+                case RegisterEntry::SUBSCRIBER:
+                    this->graph.add_subscriber(name, this->endpoint);
+                    this->topics.add_subscriber(name, entry, this->endpoint);
+                    break;
+                case RegisterEntry::SERVICE_SERVER:
+                    this->services.add_server(name, this->endpoint, entry);
+                    this->graph.add_service_server(name, this->endpoint);
+                    break;
+                case RegisterEntry::SERVICE_CLIENT:
+                    this->graph.add_service_client(name, this->endpoint);
+                    this->services.add_client(name, entry);
+                    break;
+                default:
+                    break;
+            }
+        }
+        void remove(Entry *entry) {
+            const std::string &name = entry->entry.name();
+            switch (entry->entry.kind()) {
+                case RegisterEntry::PUBLISHER:
+                    this->topics.remove_publisher(name, entry);
+                    this->graph.remove_publisher(name, this->endpoint);
+                    break;
+                case RegisterEntry::SUBSCRIBER:
+                    this->topics.remove_subscriber(name, entry);
+                    this->graph.remove_subscriber(name, this->endpoint);
+                    break;
+                case RegisterEntry::SERVICE_SERVER:
+                    if (this->services.remove_server(name, entry)) this->graph.remove_service_server(name, this->endpoint);
+                    break;
+                case RegisterEntry::SERVICE_CLIENT:
+                    this->services.remove_client(name, entry);
+                    this->graph.remove_service_client(name, this->endpoint);
+                    break;
+                default:
+                    break;
+            }
+        }
+        TopicRegistry &topics;
+        ServiceRegistry &services;
+        MasterGraph &graph;
+        RegisterBatch batch;
+        EndPoint endpoint;
+        bool registered;
+        std::vector<std::unique_ptr<Entry> > entries;
+    };
+    /* WatchGraph: a slow watcher skips intermediate versions and gets the newest graph next */
+    class GraphStream final : public StreamReactor<Graph>, public MasterGraph::Listener {
+        public:
+        GraphStream(MasterGraph &graph) : graph(graph), pending(false) {
+            this->graph.watch(this);
+        }
+        bool ready() override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->done) return false;
+            if (this->writing) {
+                this->pending = true;
+                return false;
+            }
+            this->writing = true;
+            return true;
+        }
+        void update(const std::shared_ptr<const Graph> &snapshot) override {
+            this->current = snapshot;
+            this->StartWrite(this->current.get());
+        }
+        void OnWriteDone(bool ok) override {
+            bool next = false;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->write_done(ok) && this->pending) next = true;
+                else this->writing = false;
+                this->pending = false;
+            }
+            if (next) this->update(this->graph.snapshot());
+            else if (this->done) this->finish();
+        }
+        void OnDone() override {
+            this->graph.unwatch(this);
+            delete this;
+        }
+        private:
+        MasterGraph &graph;
+        bool pending;
+        std::shared_ptr<const Graph> current;
+    };
+    class LeaseStream;
+    /*
+     * node liveness. A node holds a lease while its Lease stream is open and its heartbeats keep
+     * coming; when either stops, the node is evicted: its registrations are dropped, its streams are
+     * ended and every other node is told, so nobody keeps connecting to an endpoint that is gone.
+     */
+    class LeaseTable {
+        public:
+        using Evict = std::function<void(const EndPoint&)>;
+        LeaseTable(Evict evict) : evict(evict) {
+            std::thread([this]() {
+                while (1) {
+                    usleep(100000);
+                    this->expire();
                 }
+            }).detach();
+        }
+        void renew(LeaseStream *stream, const EndPoint &endpoint, uint32_t ttl_ms) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            Lease &lease = this->leases[MasterGraph::key(endpoint)];
+            lease.stream = stream;
+            lease.endpoint = endpoint;
+            lease.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl_ms);
+        }
+        /* the stream ended: evict its node, unless a newer stream holds the lease by now */
+        void release(LeaseStream *stream, const EndPoint &endpoint) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                auto iter = this->leases.find(MasterGraph::key(endpoint));
+                if (iter == this->leases.end() || iter->second.stream != stream) return;
+                this->leases.erase(iter);
             }
-            return Status::OK;
+            this->evicted(endpoint);
         }
         private:
+        struct Lease {
+            LeaseStream *stream;
+            EndPoint endpoint;
+            std::chrono::steady_clock::time_point deadline;
+        };
+        void expire();
+        void evicted(const EndPoint &endpoint);
         std::mutex mutex_;
-        std::mutex service_mutex_;
-        std::condition_variable publish_condition_;
-        std::condition_variable subscribe_condition_;
-        std::condition_variable service_condition_;
-        std::string receive_topic = "";
-        std::string receive_ip = "";
-        uint32_t receive_port = 0;
-        std::unordered_map<std::string, std::pair<std::string, uint32_t> > service_servers;
+        std::unordered_map<std::string, Lease> leases;
+        Evict evict;
+    };
+    class LeaseStream final : public QueuedStream<LeaseEvent, grpc::ServerBidiReactor<LeaseHeartbeat, LeaseEvent> > {
+        public:
+        LeaseStream(LeaseTable &leases) : leases(leases), leased(false) {
+            this->StartRead(&this->heartbeat);
+        }
+        void OnReadDone(bool ok) override {
+            if (!ok) {
+                this->close_stream();
+                return;
+            }
+            if (!this->leased) {
+                this->endpoint = this->heartbeat.endpoint();
+                this->leased = true;
+                std::cout << "Lease from " << MasterGraph::key(this->endpoint) << "\n";
+            }
+            this->leases.renew(this, this->endpoint, std::max(this->heartbeat.ttl_ms(), 100u));
+            this->StartRead(&this->heartbeat);
+        }
+        void OnDone() override {
+            if (this->leased) this->leases.release(this, this->endpoint);
+            delete this;
+        }
+        private:
+        LeaseTable &leases;
+        LeaseHeartbeat heartbeat;
+        EndPoint endpoint;
+        bool leased;
+    };
+    inline void LeaseTable::expire() {
+        std::vector<EndPoint> expired;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (auto iter = this->leases.begin(); iter != this->leases.end();) {
+                if (iter->second.deadline > now) {
+                    iter++;
+                    continue;
+                }
+                std::cout << "Lease of " << iter->first << " expired\n";
+                iter->second.stream->close_stream();
+                expired.push_back(iter->second.endpoint);
+                iter = this->leases.erase(iter);
+            }
+        }
+        for (const EndPoint &endpoint : expired) this->evicted(endpoint);
+    }
+    inline void LeaseTable::evicted(const EndPoint &endpoint) {
+        this->evict(endpoint);
+        LeaseEvent event;
+        *event.mutable_evicted() = endpoint;
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (auto &pair : this->leases) pair.second.stream->write(event);
+    }
+    /*
+     * runs on the gRPC callback API: registration streams are reactors instead of parked threads,
+     * so thousands of nodes are served by gRPC's small callback thread pool.
+     */
+    class RegistrationServiceImpl final : public Registration::CallbackService {
+        public:
+        grpc::ServerWriteReactor<SubscribeReply>* Subscribe(grpc::CallbackServerContext* context, const SubscribeRequest* request) override {
+            std::cout << "receive subscriber\n";
+            return new TopicStream<SubscribeReply>(topics, graph, request->topic_name(), "", request->endpoint(), false);
+        }
+        grpc::ServerWriteReactor<PublishReply>* Publish(grpc::CallbackServerContext* context, const PublishRequest* request) override {
+            std::cout << "receive publisher\n";
+            return new TopicStream<PublishReply>(topics, graph, request->topic_name(), request->type_name(), request->endpoint(), true);
+        }
+        grpc::ServerUnaryReactor* ServiceServers(grpc::CallbackServerContext* context, const ServiceServerRequest* request,
+                          ServiceServerReply *reply) override {
+            services.add_server(request->service_name(), request->endpoint());
+            graph.add_service_server(request->service_name(), request->endpoint());
+            grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+            reactor->Finish(Status::OK);
+            return reactor;
+        }
+        grpc::ServerWriteReactor<ServiceClientReply>* ServiceClients(grpc::CallbackServerContext* context, const ServiceClientRequest* request) override {
+            return new ServiceClientStream(services, graph, request->service_name(), request->endpoint());
+        }
+        grpc::ServerUnaryReactor* GetGraph(grpc::CallbackServerContext* context, const GraphRequest* request, Graph* reply) override {
+            *reply = *graph.snapshot();
+            grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+            reactor->Finish(Status::OK);
+            return reactor;
+        }
+        /* the current graph, then a new snapshot after every change */
+        grpc::ServerWriteReactor<Graph>* WatchGraph(grpc::CallbackServerContext* context, const GraphRequest* request) override {
+            return new GraphStream(graph);
+        }
+        /* how nodes register; Subscribe, Publish, ServiceServers and ServiceClients remain for older nodes */
+        grpc::ServerBidiReactor<RegisterBatch, RegisterEvent>* Register(grpc::CallbackServerContext* context) override {
+            return new NodeStream(topics, services, graph);
+        }
+        grpc::ServerBidiReactor<LeaseHeartbeat, LeaseEvent>* Lease(grpc::CallbackServerContext* context) override {
+            return new LeaseStream(leases);
+        }
+        private:
+        void evict(const EndPoint &endpoint) {
+            std::string node = MasterGraph::key(endpoint);
+            std::cout << "Evicting " << node << "\n";
+            topics.evict(node);
+            for (const std::string &service : services.evict(node)) graph.remove_service_server(service, endpoint);
+        }
+        MasterGraph graph;
+        TopicRegistry topics;
+        ServiceRegistry services;
+        LeaseTable leases{[this](const EndPoint &endpoint) { this->evict(endpoint); }};
     };
     void RunServer(std::string server_address) {
         RegistrationServiceImpl service;
@@ -0,0 +1,735 @@
+#ifndef MCAP_H
+#define MCAP_H
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
+#ifdef CORE_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * MCAP (https://mcap.dev/spec) recording of serialized protobuf messages.
+ * Subscriber threads only append message records to the open chunk, full chunks are compressed,
+ * indexed and written by a dedicated thread through a large page aligned buffer, so a slow disk
+ * never reaches the subscriber (and with it the publishers).
+ * Playback maps the file and only touches the summary plus the chunks it actually plays.
+ */
+namespace core {
+    namespace mcap {
+        const char MAGIC[8] = {'\x89', 'M', 'C', 'A', 'P', '0', '\r', '\n'};
+        enum Opcode : uint8_t {
+            HEADER = 0x01,
+            FOOTER = 0x02,
+            SCHEMA = 0x03,
+            CHANNEL = 0x04,
+            MESSAGE = 0x05,
+            CHUNK = 0x06,
+            MESSAGE_INDEX = 0x07,
+            CHUNK_INDEX = 0x08,
+            STATISTICS = 0x0B,
+            SUMMARY_OFFSET = 0x0E,
+            DATA_END = 0x0F,
+        };
+        /* every integer in mcap is little endian */
+        inline void put(std::string &buf, uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; i++) buf.push_back((char)(value >> (8 * i)));
+        }
+        inline void put8(std::string &buf, uint8_t value) { put(buf, value, 1); }
+        inline void put16(std::string &buf, uint16_t value) { put(buf, value, 2); }
+        inline void put32(std::string &buf, uint32_t value) { put(buf, value, 4); }
+        inline void put64(std::string &buf, uint64_t value) { put(buf, value, 8); }
+        inline void put_string(std::string &buf, const std::string &value) {
+            put32(buf, value.size());
+            buf.append(value);
+        }
+        /* opcode + length placeholder, end_record() patches the length once the content is written */
+        inline size_t begin_record(std::string &buf, Opcode opcode) {
+            put8(buf, opcode);
+            size_t at = buf.size();
+            put64(buf, 0);
+            return at;
+        }
+        inline void end_record(std::string &buf, size_t at) {
+            uint64_t length = buf.size() - at - 8;
+            for (int i = 0; i < 8; i++) buf[at + i] = (char)(length >> (8 * i));
+        }
+        /* the FileDescriptorSet of a compiled-in message type, dependencies first */
+        inline void add_file(const google::protobuf::FileDescriptor *file, std::set<std::string> &seen, google::protobuf::FileDescriptorSet &set) {
+            if (!seen.insert(file->name()).second) return;
+            for (int i = 0; i < file->dependency_count(); i++) add_file(file->dependency(i), seen, set);
+            file->CopyTo(set.add_file());
+        }
+        /* bounds checked little endian reads, ok turns false on the first read past the end */
+        struct Cursor {
+            Cursor(const char *data, size_t size) : p(data), end(data + size), ok(true) {}
+            /* one integer of up to 8 bytes, fields that are not needed are skip()ped */
+            uint64_t get(int bytes) {
+                assert(bytes >= 0 && bytes <= 8);
+                if (end - p < bytes) {
+                    ok = false;
+                    return 0;
+                }
+                uint64_t value = 0;
+                for (int i = 0; i < bytes; i++) value |= (uint64_t)(uint8_t)p[i] << (8 * i);
+                p += bytes;
+                return value;
+            }
+            void skip(size_t size) {
+                if ((size_t)(end - p) < size) {
+                    ok = false;
+                    return;
+                }
+                p += size;
+            }
+            const char *bytes(uint64_t size) {
+                if ((uint64_t)(end - p) < size) {
+                    ok = false;
+                    return nullptr;
+                }
+                const char *data = p;
+                p += size;
+                return data;
+            }
+            std::string string() {
+                uint32_t size = get(4);
+                const char *data = bytes(size);
+                return data ? std::string(data, size) : std::string();
+            }
+            const char *p;
+            const char *end;
+            bool ok;
+        };
+        inline bool file_descriptor_set(const std::string &type_name, std::string &data) {
+            const google::protobuf::Descriptor *descriptor =
+                google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type_name);
+            if (!descriptor) return false;
+            google::protobuf::FileDescriptorSet set;
+            std::set<std::string> seen;
+            add_file(descriptor->file(), seen, set);
+            return set.SerializeToString(&data);
+        }
+    }
+    class McapWriter {
+        public:
+        /* compression is "" or "zstd" (when built with zstd), chunk_size is the uncompressed size of a chunk */
+        McapWriter(std::string path, std::string compression, size_t chunk_size, bool &ret) :
+            compression(compression), chunk_size(chunk_size), offset_(0), used_(0), closed(true),
+            dropped(0), message_count(0), message_start_time(0), message_end_time(0)
+        {
+            ret = false;
+#ifndef CORE_WITH_ZSTD
+            if (!compression.empty()) {
+                std::cerr << "Compression " << compression << " is not supported by this build.\n";
+                return;
+            }
+#else
+            if (!compression.empty() && compression != "zstd") {
+                std::cerr << "Compression " << compression << " is not supported, use zstd.\n";
+                return;
+            }
+#endif
+            this->fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (this->fd_ < 0) {
+                std::cerr << "Error opening " << path << "\n";
+                return;
+            }
+            if (posix_memalign((void **)&this->buf_, BUFFER_ALIGN, BUFFER_SIZE) != 0) {
+                std::cerr << "Error allocating write buffer.\n";
+                ::close(this->fd_);
+                return;
+            }
+            this->open_chunk = this->new_chunk();
+            std::string header;
+            size_t at = mcap::begin_record(header, mcap::HEADER);
+            mcap::put_string(header, "");
+            mcap::put_string(header, "grpc_core");
+            mcap::end_record(header, at);
+            this->append(mcap::MAGIC, sizeof(mcap::MAGIC));
+            this->append(header.data(), header.size());
+            this->closed = false;
+            this->writer_thread_ = std::thread([this]() {
+                this->write_loop();
+            });
+            ret = true;
+        }
+        ~McapWriter() {
+            this->close();
+        }
+        uint16_t add_channel(std::string topic) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            Channel channel;
+            channel.topic = topic;
+            this->channels.push_back(channel);
+            return this->channels.size();
+        }
+        /* append one message to the open chunk, called from the subscriber threads */
+        void write(uint16_t channel_id, const std::string &type_name, uint64_t log_time, const char *data, uint32_t size) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->closed) return;
+            Channel &channel = this->channels[channel_id - 1];
+            if (channel.type_name.empty()) channel.type_name = type_name;
+            /* a chunk is also closed once it spans CHUNK_DURATION so slow topics still reach the disk,
+               log times are not monotonic across subscriber threads so the span is max - min */
+            const Chunk &current = *this->open_chunk;
+            if (current.records.size() >= this->chunk_size ||
+                (!current.index.empty() && std::max(log_time, current.end_time) - std::min(log_time, current.start_time) >= CHUNK_DURATION)) {
+                /* the disk is not keeping up, drop instead of growing without bound */
+                if (this->full_chunks.size() >= MAX_PENDING_CHUNKS) {
+                    this->dropped++;
+                    return;
+                }
+                this->full_chunks.push_back(this->open_chunk);
+                this->open_chunk = this->new_chunk();
+                this->cv_.notify_one();
+            }
+            Chunk &chunk = *this->open_chunk;
+            if (chunk.index.empty() || log_time < chunk.start_time) chunk.start_time = log_time;
+            if (chunk.index.empty() || log_time > chunk.end_time) chunk.end_time = log_time;
+            chunk.index.push_back(IndexEntry{channel_id, log_time, chunk.records.size()});
+            std::string &records = chunk.records;
+            size_t at = mcap::begin_record(records, mcap::MESSAGE);
+            mcap::put16(records, channel_id);
+            mcap::put32(records, channel.sequence++);
+            mcap::put64(records, log_time);
+            mcap::put64(records, log_time);
+            records.append(data, size);
+            mcap::end_record(records, at);
+        }
+        /* write the remaining chunk, the index and summary, then close the file */
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->closed) return;
+                this->closed = true;
+                if (!this->open_chunk->index.empty()) this->full_chunks.push_back(this->open_chunk);
+            }
+            this->cv_.notify_one();
+            if (this->writer_thread_.joinable()) this->writer_thread_.join();
+            this->write_summary();
+            this->flush();
+            fsync(this->fd_);
+            ::close(this->fd_);
+            free(this->buf_);
+            if (this->dropped > 0) std::cerr << "Recorder dropped " << this->dropped << " messages, the disk could not keep up\n";
+        }
+        uint64_t messages() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->message_count;
+        }
+        private:
+        static const size_t BUFFER_ALIGN = 4096;
+        static const size_t BUFFER_SIZE = 4 << 20;
+        static const size_t MAX_PENDING_CHUNKS = 64;
+        static const uint64_t CHUNK_DURATION = 1000000000;
+        struct Channel {
+            std::string topic;
+            std::string type_name;
+            uint32_t sequence = 0;
+            uint64_t message_count = 0;
+            bool written = false;
+        };
+        struct IndexEntry {
+            uint16_t channel_id;
+            uint64_t log_time;
+            uint64_t offset;
+        };
+        struct Chunk {
+            std::string records;
+            std::vector<IndexEntry> index;
+            uint64_t start_time = 0;
+            uint64_t end_time = 0;
+        };
+        /* chunks are recycled by the writer thread, so their buffers are allocated once */
+        std::shared_ptr<Chunk> new_chunk() {
+            if (!this->free_chunks.empty()) {
+                std::shared_ptr<Chunk> chunk = this->free_chunks.back();
+                this->free_chunks.pop_back();
+                return chunk;
+            }
+            std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+            chunk->records.reserve(this->chunk_size + (this->chunk_size >> 2));
+            return chunk;
+        }
+        void write_loop() {
+            while (1) {
+                std::shared_ptr<Chunk> chunk;
+                std::vector<std::pair<uint16_t, Channel> > new_channels;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex_);
+                    this->cv_.wait(lock, [this]() {
+                        return !this->full_chunks.empty() || this->closed;
+                    });
+                    if (this->full_chunks.empty()) break;
+                    chunk = this->full_chunks.front();
+                    this->full_chunks.pop_front();
+                    for (const IndexEntry &entry : chunk->index) {
+                        Channel &channel = this->channels[entry.channel_id - 1];
+                        channel.message_count++;
+                        if (channel.written) continue;
+                        channel.written = true;
+                        new_channels.push_back(std::make_pair(entry.channel_id, channel));
+                    }
+                    if (this->message_count == 0 || chunk->start_time < this->message_start_time) this->message_start_time = chunk->start_time;
+                    if (this->message_count == 0 || chunk->end_time > this->message_end_time) this->message_end_time = chunk->end_time;
+                    this->message_count += chunk->index.size();
+                }
+                this->write_chunk(*chunk, new_channels);
+                chunk->records.clear();
+                chunk->index.clear();
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->free_chunks.push_back(chunk);
+            }
+        }
+        /* schema and channel records of channels first seen in this chunk go in front of its messages */
+        void write_chunk(const Chunk &chunk, const std::vector<std::pair<uint16_t, Channel> > &new_channels) {
+            std::string prefix;
+            for (auto &pair : new_channels) {
+                uint16_t schema_id = this->schema(pair.second.type_name);
+                if (schema_id != 0) prefix.append(this->schema_records[schema_id - 1]);
+                std::string record;
+                size_t at = mcap::begin_record(record, mcap::CHANNEL);
+                mcap::put16(record, pair.first);
+                mcap::put16(record, schema_id);
+                mcap::put_string(record, pair.second.topic);
+                mcap::put_string(record, "protobuf");
+                mcap::put32(record, 0);
+                mcap::end_record(record, at);
+                prefix.append(record);
+                this->channel_records.push_back(record);
+            }
+            std::string joined;
+            const std::string *uncompressed = &chunk.records;
+            if (!prefix.empty()) {
+                joined = prefix + chunk.records;
+                uncompressed = &joined;
+            }
+            const char *records = uncompressed->data();
+            size_t records_size = uncompressed->size();
+#ifdef CORE_WITH_ZSTD
+            if (this->compression == "zstd") {
+                this->compressed.resize(ZSTD_compressBound(uncompressed->size()));
+                size_t size = ZSTD_compress(&this->compressed[0], this->compressed.size(), uncompressed->data(), uncompressed->size(), 1);
+                if (!ZSTD_isError(size)) {
+                    records = this->compressed.data();
+                    records_size = size;
+                }
+                else std::cerr << "Error compressing chunk: " << ZSTD_getErrorName(size) << "\n";
+            }
+            const std::string chunk_compression = records == uncompressed->data() ? "" : this->compression;
+#else
+            const std::string chunk_compression = "";
+#endif
+            std::string head;
+            mcap::put8(head, mcap::CHUNK);
+            size_t content_size = 8 + 8 + 8 + 4 + 4 + chunk_compression.size() + 8 + records_size;
+            mcap::put64(head, content_size);
+            mcap::put64(head, chunk.start_time);
+            mcap::put64(head, chunk.end_time);
+            mcap::put64(head, uncompressed->size());
+            mcap::put32(head, 0);
+            mcap::put_string(head, chunk_compression);
+            mcap::put64(head, records_size);
+            uint64_t chunk_start = this->offset_ + this->used_;
+            this->append(head.data(), head.size());
+            this->append(records, records_size);
+            uint64_t chunk_length = this->offset_ + this->used_ - chunk_start;
+            /* per channel message index, offsets are into the uncompressed records */
+            std::map<uint16_t, std::string> message_indexes;
+            for (const IndexEntry &entry : chunk.index) {
+                std::string &index = message_indexes[entry.channel_id];
+                mcap::put64(index, entry.log_time);
+                mcap::put64(index, prefix.size() + entry.offset);
+            }
+            std::string chunk_index;
+            size_t at = mcap::begin_record(chunk_index, mcap::CHUNK_INDEX);
+            mcap::put64(chunk_index, chunk.start_time);
+            mcap::put64(chunk_index, chunk.end_time);
+            mcap::put64(chunk_index, chunk_start);
+            mcap::put64(chunk_index, chunk_length);
+            mcap::put32(chunk_index, message_indexes.size() * 10);
+            uint64_t index_start = this->offset_ + this->used_;
+            std::string records_index;
+            for (auto &pair : message_indexes) {
+                mcap::put16(chunk_index, pair.first);
+                mcap::put64(chunk_index, index_start + records_index.size());
+                size_t index_at = mcap::begin_record(records_index, mcap::MESSAGE_INDEX);
+                mcap::put16(records_index, pair.first);
+                mcap::put_string(records_index, pair.second);
+                mcap::end_record(records_index, index_at);
+            }
+            this->append(records_index.data(), records_index.size());
+            mcap::put64(chunk_index, records_index.size());
+            mcap::put_string(chunk_index, chunk_compression);
+            mcap::put64(chunk_index, records_size);
+            mcap::put64(chunk_index, uncompressed->size());
+            mcap::end_record(chunk_index, at);
+            this->chunk_indexes.push_back(chunk_index);
+        }
+        /* schema id of a type, 0 (no schema) when the type is not compiled into this binary */
+        uint16_t schema(const std::string &type_name) {
+            auto iter = this->schema_ids.find(type_name);
+            if (iter != this->schema_ids.end()) return iter->second;
+            uint16_t schema_id = 0;
+            std::string data;
+            if (!type_name.empty() && mcap::file_descriptor_set(type_name, data)) {
+                std::string record;
+                size_t at = mcap::begin_record(record, mcap::SCHEMA);
+                mcap::put16(record, this->schema_records.size() + 1);
+                mcap::put_string(record, type_name);
+                mcap::put_string(record, "protobuf");
+                mcap::put_string(record, data);
+                mcap::end_record(record, at);
+                this->schema_records.push_back(record);
+                schema_id = this->schema_records.size();
+            }
+            else std::cerr << "No schema for " << (type_name.empty() ? "unknown type" : type_name) << ", recording without it\n";
+            this->schema_ids[type_name] = schema_id;
+            return schema_id;
+        }
+        void write_summary() {
+            std::string data_end;
+            size_t at = mcap::begin_record(data_end, mcap::DATA_END);
+            mcap::put32(data_end, 0);
+            mcap::end_record(data_end, at);
+            this->append(data_end.data(), data_end.size());
+
+            uint64_t summary_start = this->offset_ + this->used_;
+            std::string offsets;
+            auto group = [this, &offsets](mcap::Opcode opcode, const std::vector<std::string> &records) {
+                if (records.empty()) return;
+                uint64_t start = this->offset_ + this->used_;
+                for (const std::string &record : records) this->append(record.data(), record.size());
+                size_t offset_at = mcap::begin_record(offsets, mcap::SUMMARY_OFFSET);
+                mcap::put8(offsets, opcode);
+                mcap::put64(offsets, start);
+                mcap::put64(offsets, this->offset_ + this->used_ - start);
+                mcap::end_record(offsets, offset_at);
+            };
+            std::string statistics;
+            at = mcap::begin_record(statistics, mcap::STATISTICS);
+            mcap::put64(statistics, this->message_count);
+            mcap::put16(statistics, this->schema_records.size());
+            mcap::put32(statistics, this->channel_records.size());
+            mcap::put32(statistics, 0);
+            mcap::put32(statistics, 0);
+            mcap::put32(statistics, this->chunk_indexes.size());
+            mcap::put64(statistics, this->message_start_time);
+            mcap::put64(statistics, this->message_end_time);
+            mcap::put32(statistics, this->channel_records.size() * 10);
+            for (size_t i = 0; i < this->channels.size(); i++) {
+                if (!this->channels[i].written) continue;
+                mcap::put16(statistics, i + 1);
+                mcap::put64(statistics, this->channels[i].message_count);
+            }
+            mcap::end_record(statistics, at);
+            group(mcap::SCHEMA, this->schema_records);
+            group(mcap::CHANNEL, this->channel_records);
+            group(mcap::STATISTICS, std::vector<std::string>{statistics});
+            group(mcap::CHUNK_INDEX, this->chunk_indexes);
+
+            uint64_t summary_offset_start = this->offset_ + this->used_;
+            this->append(offsets.data(), offsets.size());
+            std::string footer;
+            at = mcap::begin_record(footer, mcap::FOOTER);
+            mcap::put64(footer, summary_start);
+            mcap::put64(footer, summary_offset_start);
+            mcap::put32(footer, 0);
+            mcap::end_record(footer, at);
+            this->append(footer.data(), footer.size());
+            this->append(mcap::MAGIC, sizeof(mcap::MAGIC));
+        }
+        /* writer thread only: the file is written in whole BUFFER_SIZE blocks except for the tail */
+        void append(const char *data, size_t size) {
+            while (size > 0) {
+                size_t step = std::min(size, BUFFER_SIZE - this->used_);
+                memcpy(this->buf_ + this->used_, data, step);
+                this->used_ += step;
+                data += step;
+                size -= step;
+                if (this->used_ == BUFFER_SIZE) this->flush();
+            }
+        }
+        void flush() {
+            size_t written = 0;
+            while (written < this->used_) {
+                ssize_t ret = ::write(this->fd_, this->buf_ + written, this->used_ - written);
+                if (ret < 0) {
+                    if (errno == EINTR) continue;
+                    std::cerr << "Error writing recording.\n";
+                    break;
+                }
+                written += ret;
+            }
+            this->offset_ += this->used_;
+            this->used_ = 0;
+        }
+        std::string compression;
+        size_t chunk_size;
+        int fd_;
+        char *buf_;
+        uint64_t offset_;
+        size_t used_;
+        std::thread writer_thread_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool closed;
+        uint64_t dropped;
+        std::vector<Channel> channels;
+        std::shared_ptr<Chunk> open_chunk;
+        std::deque<std::shared_ptr<Chunk> > full_chunks;
+        std::vector<std::shared_ptr<Chunk> > free_chunks;
+        /* writer thread only */
+        std::string compressed;
+        std::map<std::string, uint16_t> schema_ids;
+        std::vector<std::string> schema_records;
+        std::vector<std::string> channel_records;
+        std::vector<std::string> chunk_indexes;
+        uint64_t message_count;
+        uint64_t message_start_time;
+        uint64_t message_end_time;
+    };
+    class McapReader {
+        public:
+        struct Schema {
+            std::string name;
+            std::string encoding;
+            std::string data;
+        };
+        struct Channel {
+            std::string topic;
+            uint16_t schema_id;
+            std::string message_encoding;
+        };
+        struct Message {
+            uint16_t channel_id;
+            uint64_t log_time;
+            const char *data;
+            uint32_t size;
+        };
+        McapReader(std::string path, bool &ret) : start_time(0), end_time(0), data_(nullptr), size_(0) {
+            ret = false;
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                std::cerr << "Error opening " << path << "\n";
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                    this->data_ = (const char *)map;
+                    this->size_ = st.st_size;
+                }
+            }
+            close(fd);
+            if (!this->data_) {
+                std::cerr << "Error mapping " << path << "\n";
+                return;
+            }
+            ret = this->read_summary();
+            if (!ret) std::cerr << path << " has no summary (recording not closed properly?)\n";
+        }
+        ~McapReader() {
+            if (this->data_) munmap((void *)this->data_, this->size_);
+        }
+        /* calls func for every message logged at or after from, in time order, until func returns false */
+        void read(uint64_t from, std::function<bool(const Message &msg)> func) {
+            /* chunks whose time ranges overlap (messages logged out of order by different threads) are merged */
+            std::vector<const ChunkIndex *> group;
+            uint64_t group_end = 0;
+            for (const ChunkIndex &chunk : this->chunks) {
+                if (chunk.end_time < from) continue;
+                if (!group.empty() && chunk.start_time > group_end) {
+                    if (!this->read_group(group, from, func)) return;
+                    group.clear();
+                }
+                if (group.empty() || chunk.end_time > group_end) group_end = chunk.end_time;
+                group.push_back(&chunk);
+            }
+            if (!group.empty()) this->read_group(group, from, func);
+        }
+        std::map<uint16_t, Schema> schemas;
+        std::map<uint16_t, Channel> channels;
+        uint64_t start_time;
+        uint64_t end_time;
+        private:
+        struct ChunkIndex {
+            uint64_t start_time;
+            uint64_t end_time;
+            uint64_t offset;
+            std::map<uint16_t, uint64_t> message_index_offsets;
+        };
+        bool read_summary() {
+            const size_t footer_size = 1 + 8 + 8 + 8 + 4;
+            if (this->size_ < 2 * sizeof(mcap::MAGIC) + footer_size ||
+                memcmp(this->data_, mcap::MAGIC, sizeof(mcap::MAGIC)) != 0 ||
+                memcmp(this->data_ + this->size_ - sizeof(mcap::MAGIC), mcap::MAGIC, sizeof(mcap::MAGIC)) != 0) return false;
+            uint64_t footer_at = this->size_ - sizeof(mcap::MAGIC) - footer_size;
+            mcap::Cursor footer(this->data_ + footer_at, footer_size);
+            if (footer.get(1) != mcap::FOOTER) return false;
+            footer.get(8);
+            uint64_t summary_start = footer.get(8);
+            if (summary_start == 0 || summary_start > footer_at) return false;
+            mcap::Cursor cursor(this->data_ + summary_start, footer_at - summary_start);
+            bool statistics = false;
+            while (cursor.p < cursor.end && cursor.ok) {
+                uint8_t opcode = cursor.get(1);
+                uint64_t length = cursor.get(8);
+                const char *content = cursor.bytes(length);
+                if (!cursor.ok) break;
+                mcap::Cursor record(content, length);
+                if (opcode == mcap::SCHEMA) {
+                    uint16_t id = record.get(2);
+                    Schema &schema = this->schemas[id];
+                    schema.name = record.string();
+                    schema.encoding = record.string();
+                    schema.data = record.string();
+                }
+                else if (opcode == mcap::CHANNEL) {
+                    uint16_t id = record.get(2);
+                    Channel &channel = this->channels[id];
+                    channel.schema_id = record.get(2);
+                    channel.topic = record.string();
+                    channel.message_encoding = record.string();
+                }
+                else if (opcode == mcap::STATISTICS) {
+                    record.skip(8 + 2 + 4 + 4 + 4 + 4);
+                    this->start_time = record.get(8);
+                    this->end_time = record.get(8);
+                    statistics = true;
+                }
+                else if (opcode == mcap::CHUNK_INDEX) {
+                    ChunkIndex chunk;
+                    chunk.start_time = record.get(8);
+                    chunk.end_time = record.get(8);
+                    chunk.offset = record.get(8);
+                    record.get(8);
+                    uint32_t length = record.get(4);
+                    for (uint32_t i = 0; i + 10 <= length && record.ok; i += 10) {
+                        uint16_t channel_id = record.get(2);
+                        chunk.message_index_offsets[channel_id] = record.get(8);
+                    }
+                    if (record.ok && chunk.offset < this->size_) this->chunks.push_back(chunk);
+                }
+            }
+            std::sort(this->chunks.begin(), this->chunks.end(), [](const ChunkIndex &a, const ChunkIndex &b) {
+                return a.start_time < b.start_time;
+            });
+            if (!statistics && !this->chunks.empty()) {
+                this->start_time = this->chunks.front().start_time;
+                for (const ChunkIndex &chunk : this->chunks) this->end_time = std::max(this->end_time, chunk.end_time);
+            }
+            return true;
+        }
+        struct Entry {
+            uint64_t log_time;
+            size_t chunk;
+            uint64_t offset;
+            bool operator<(const Entry &other) const {
+                if (log_time != other.log_time) return log_time < other.log_time;
+                if (chunk != other.chunk) return chunk < other.chunk;
+                return offset < other.offset;
+            }
+        };
+        /* the messages of a group of chunks, false once func returned false */
+        bool read_group(const std::vector<const ChunkIndex *> &group, uint64_t from, std::function<bool(const Message &msg)> &func) {
+            std::vector<std::string> buffers(group.size());
+            std::vector<std::pair<const char *, uint64_t> > records(group.size(), std::make_pair(nullptr, 0));
+            std::vector<Entry> entries;
+            for (size_t i = 0; i < group.size(); i++) {
+                if (!this->chunk_records(*group[i], buffers[i], records[i].first, records[i].second)) continue;
+                /* the message indexes give (time, offset) of every message without scanning the chunk */
+                for (auto &pair : group[i]->message_index_offsets) {
+                    mcap::Cursor cursor(this->data_ + pair.second, this->size_ - pair.second);
+                    if (cursor.get(1) != mcap::MESSAGE_INDEX) continue;
+                    cursor.skip(8 + 2);
+                    uint32_t length = cursor.get(4);
+                    for (uint32_t j = 0; j + 16 <= length && cursor.ok; j += 16) {
+                        uint64_t log_time = cursor.get(8);
+                        uint64_t offset = cursor.get(8);
+                        if (log_time >= from) entries.push_back(Entry{log_time, i, offset});
+                    }
+                }
+            }
+            std::sort(entries.begin(), entries.end());
+            for (const Entry &entry : entries) {
+                uint64_t records_size = records[entry.chunk].second;
+                mcap::Cursor cursor(records[entry.chunk].first + std::min(entry.offset, records_size), records_size - std::min(entry.offset, records_size));
+                if (cursor.get(1) != mcap::MESSAGE) continue;
+                uint64_t length = cursor.get(8);
+                Message msg;
+                msg.channel_id = cursor.get(2);
+                cursor.skip(4);
+                msg.log_time = cursor.get(8);
+                cursor.skip(8);
+                msg.size = length - 22;
+                msg.data = cursor.bytes(msg.size);
+                if (!cursor.ok || length < 22) continue;
+                if (!func(msg)) return false;
+            }
+            return true;
+        }
+        /* uncompressed chunks are read in place from the mapping, compressed ones into buffer */
+        bool chunk_records(const ChunkIndex &chunk, std::string &buffer, const char *&records, uint64_t &records_size) {
+            mcap::Cursor cursor(this->data_ + chunk.offset, this->size_ - chunk.offset);
+            if (cursor.get(1) != mcap::CHUNK) return false;
+            cursor.get(8);
+            cursor.skip(16);
+            uint64_t uncompressed_size = cursor.get(8);
+            cursor.get(4);
+            std::string compression = cursor.string();
+            records_size = cursor.get(8);
+            records = cursor.bytes(records_size);
+            if (!cursor.ok) return false;
+            if (compression.empty()) return true;
+            /* the size comes from the file, a corrupt one must not decide how much memory we take */
+            if (uncompressed_size > MAX_CHUNK_SIZE) {
+                std::cerr << "Skipping chunk at " << chunk.offset << " of " << uncompressed_size << " bytes uncompressed\n";
+                return false;
+            }
+#ifdef CORE_WITH_ZSTD
+            if (compression == "zstd") {
+                buffer.resize(uncompressed_size);
+                size_t size = ZSTD_decompress(&buffer[0], buffer.size(), records, records_size);
+                if (ZSTD_isError(size) || size != uncompressed_size) {
+                    std::cerr << "Error decompressing chunk at " << chunk.offset << "\n";
+                    return false;
+                }
+                records = buffer.data();
+                records_size = size;
+                return true;
+            }
+#endif
+            std::cerr << "Skipping chunk with unsupported compression " << compression << "\n";
+            return false;
+        }
+        static const uint64_t MAX_CHUNK_SIZE = 1ull << 30;
+        const char *data_;
+        size_t size_;
+        std::vector<ChunkIndex> chunks;
+    };
+}
+
+#endif
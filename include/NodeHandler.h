@@ -2,8 +2,22 @@
 #define NODEHANDLER_H
 
 #include <iostream>
+#include <fstream>
 #include <queue>
+#include <future>
+#include <stdexcept>
+#include <set>
+#include <algorithm>
 #include "TCPSocket.h"
+#include "Link.h"
+#include "Filter.h"
+#include "Balancer.h"
+#include "WorkerPool.h"
+#include "ChannelCache.h"
+#include "Histogram.h"
+#include "Registrar.h"
+#include "Discovery.h"
+#include "StreamThreads.h"
 
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include <grpcpp/grpcpp.h>
@@ -15,6 +29,7 @@
 #include "connection.grpc.pb.h"
 #include "serviceserving.grpc.pb.h"
 #include <google/protobuf/any.pb.h>
+#include <google/protobuf/dynamic_message.h>
 #include "Timer.h"
 
 #include <signal.h>
@@ -28,7 +43,8 @@ namespace core {
     using grpc::ServerBuilder;
     using grpc::ServerContext;
     using grpc::Status;
-    std::condition_variable spin_cv;
+    /* never destroyed: the subscribers' spin threads still wait on it while the program exits */
+    std::condition_variable &spin_cv = *new std::condition_variable();
     std::mutex spin_mutex_;
     void spinOnce() {
         spin_cv.notify_all();
@@ -36,27 +52,138 @@ namespace core {
     class NodeHandler;
     class ConnectionServiceImpl;
     class ServerClientServiceImpl;
+    class CacheWatchers;
+    /* the peers an endpoint is currently linked with, so a node can wait for them instead of sleeping */
+    class MatchCounter {
+        public:
+        void add(const std::string &peer) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->peers.insert(peer);
+            }
+            this->cv_.notify_all();
+        }
+        void remove(const std::string &peer) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->peers.erase(peer);
+        }
+        size_t count() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->peers.size();
+        }
+        bool wait(size_t n, std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            return this->cv_.wait_for(lock, timeout, [&]() { return this->peers.size() >= n; });
+        }
+        private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::set<std::string> peers;
+    };
+    /* what a running action reports through, implemented by the Act call that started it */
+    class ActionStream {
+        public:
+        virtual ~ActionStream() {}
+        virtual bool cancelled() = 0;
+        virtual void feedback(const std::string &feedback) = 0;
+    };
     class Communicator {
         public: 
         Communicator() {}
-        virtual void call(std::string &ip, uint32_t &port, float &freq) {}
-        virtual void request_handler(google::protobuf::Any request, ServingReply &reply) {}
+        /* subscribers of a publisher, publishers of a subscriber, or the servers of a service client */
+        size_t matched() { return this->matches.count(); }
+        /* true once at least n peers are linked, false if the timeout passed first */
+        bool waitForMatched(size_t n, std::chrono::milliseconds timeout) { return this->matches.wait(n, timeout); }
+        virtual void call(SubscriberRequest &request) {}
+        virtual void request_handler(const google::protobuf::Any &request, ServingReply &reply) {}
+        /* serialized request in, serialized reply out; false if the request does not parse */
+        virtual bool handle(const std::string &request, std::string &reply) { return false; }
+        /* runs an action to its end: feedback goes to stream, false if the goal does not parse */
+        virtual bool execute(const std::string &goal, ActionStream &stream, std::string &result) { return false; }
+        /* runs a service call, false if the call is rejected */
+        virtual bool dispatch(std::function<void()> job) { return false; }
+        /* service calls that may run at once */
+        virtual size_t concurrency() { return 1; }
+        /* the clients caching this service's replies, nullptr if it cannot invalidate them */
+        virtual CacheWatchers *cache_watchers() { return nullptr; }
+        /* full protobuf name of the topic's message, exchanged during the connection handshake */
+        virtual std::string type_name() { return ""; }
+        virtual void set_type_name(std::string type_name) {}
+        /* the master evicted the node at endpoint (crashed, hung or gone) */
+        virtual void evicted(const EndPoint &endpoint) {}
+        /* a publisher of our topic, or a server of our service, was found at this node */
+        virtual void connect(const EndPoint &peer) {}
+        /* announces the topic to the master or discovery, once the node can route handshakes to it */
+        virtual void start() {}
+        /* a publisher at peer asked us for a link (Path 1), it is matched like one we asked */
+        void linked(const EndPoint &peer) { this->matches.add(peer_key(peer)); }
+        /* what is wrong with a subscriber's filters for the published type, empty if they fit */
+        virtual std::string filter_error(const google::protobuf::RepeatedPtrField<FieldFilter> &filters) { return ""; }
+        /* why a publisher last refused to link with us, e.g. a filter on a field its type lacks; empty if none did */
+        std::string refusal() {
+            std::lock_guard<std::mutex> lock(this->refusal_mutex_);
+            return this->refusal_;
+        }
+        void refuse(const std::string &reason) {
+            std::cerr << "Subscription refused: " << reason << "\n";
+            std::lock_guard<std::mutex> lock(this->refusal_mutex_);
+            this->refusal_ = reason;
+        }
+        protected:
+        static std::string peer_key(const EndPoint &endpoint) {
+            return endpoint.ip() + ":" + std::to_string(endpoint.port());
+        }
+        MatchCounter matches;
+        std::mutex refusal_mutex_;
+        std::string refusal_;
     };
     template<class T>
     class Subscriber : public Communicator {
         using FunctionType = void(*)(T);
         public:
-        Subscriber(std::string topic, float freq, void (*func)(T), NodeHandler *nh, int maxSize = 1) ;
-        void call(std::string &ip, uint32_t &port, float &freq) override {
-            std::lock_guard<std::mutex> lock(this->mutex_);
-            ip = this->tcp_ip;
-            port = this->tcp_port;
-            freq = this->rate;
+        Subscriber(std::string topic, float freq, void (*func)(T), NodeHandler *nh, int maxSize = 1, Filter filter = Filter(), FlowControl flow = FlowControl()) ;
+        ~Subscriber() {
+            {
+                std::lock_guard<std::mutex> lock(spin_mutex_);
+                this->stopped = true;
+            }
+            spin_cv.notify_all();
+            if (this->spin_thread.get_id() == std::this_thread::get_id()) this->spin_thread.detach();
+            else this->spin_thread.join();
+        }
+        void start() override;
+        void call(SubscriberRequest &request) override;
+        void connect(const EndPoint &publisher) override;
+        void evicted(const EndPoint &endpoint) override {
+            this->matches.remove(peer_key(endpoint));
         }
         private:
+        /* a received message and the link its credit goes back to once it is consumed or dropped */
+        struct Delivery {
+            T msg;
+            std::shared_ptr<InLink> link;
+        };
+        void deliver(const char *data, uint32_t size, const std::shared_ptr<InLink> &link) {
+            Delivery delivery;
+            delivery.link = link;
+            if (!delivery.msg.ParseFromArray(data, size)) {
+                link->consumed(this->topic_id, this->flow.credits());
+                return;
+            }
+            std::shared_ptr<InLink> dropped;
+            {
+                std::lock_guard<std::mutex> lock(this->queue_mutex_);
+                if (this->msgs_queue.size() >= (size_t)this->maxSize) {
+                    dropped = this->msgs_queue.front().link;
+                    this->msgs_queue.pop();
+                }
+                this->msgs_queue.push(std::move(delivery));
+            }
+            if (dropped) dropped->consumed(this->topic_id, this->flow.credits());
+        }
         NodeHandler* nh_;
         FunctionType cb_func;
-        std::queue<T> msgs_queue;
+        std::queue<Delivery> msgs_queue;
         std::mutex mutex_;
         std::mutex queue_mutex_;
         
@@ -64,77 +191,425 @@ namespace core {
         uint32_t rpc_port;
         std::string tcp_ip;
         float rate;
-        AcceptorSocket tcp_acceptor;
+        std::string uds_path;
+        uint32_t topic_id;
+        Filter filter;
+        FlowControl flow;
         int maxSize = 1;
         std::string topic_name;
+        /* under spin_mutex_ */
+        bool stopped = false;
+        std::thread spin_thread;
+    };
+    /* serialized bytes of one message, only valid during the callback */
+    struct RawMessage {
+        const std::string &topic_name;
+        const std::string &type_name;
+        const char *data;
+        uint32_t size;
+    };
+    using RawCallback = std::function<void(const RawMessage &msg)>;
+    /*
+     * subscription without parsing, for recorders, relays and monitors.
+     * The callback runs directly on the link's receive thread (not in spinOnce) on the received buffer.
+     */
+    class RawSubscriber : public Communicator {
+        public:
+        RawSubscriber(std::string topic, RawCallback func, NodeHandler *nh, float freq = 0, Filter filter = Filter(), FlowControl flow = FlowControl());
+        void start() override;
+        void call(SubscriberRequest &request) override;
+        void connect(const EndPoint &publisher) override;
+        void evicted(const EndPoint &endpoint) override {
+            this->matches.remove(peer_key(endpoint));
+        }
+        std::string type_name() override {
+            return *std::atomic_load(&this->type_name_);
+        }
+        void set_type_name(std::string type_name) override {
+            if (type_name.empty()) return;
+            std::atomic_store(&this->type_name_, std::make_shared<const std::string>(type_name));
+        }
+        private:
+        void deliver(const char *data, uint32_t size, const std::shared_ptr<InLink> &link) {
+            std::shared_ptr<const std::string> type_name = std::atomic_load(&this->type_name_);
+            this->cb_func(RawMessage{this->topic_name, *type_name, data, size});
+            link->consumed(this->topic_id, this->flow.credits());
+        }
+        NodeHandler* nh_;
+        RawCallback cb_func;
+        std::shared_ptr<const std::string> type_name_;
+        std::mutex mutex_;
+
+        uint32_t tcp_port;
+        uint32_t rpc_port;
+        std::string tcp_ip;
+        float rate;
+        std::string uds_path;
+        uint32_t topic_id;
+        Filter filter;
+        FlowControl flow;
+        std::string topic_name;
     };
     template<class T>
     class Publisher : public Communicator {
         public:
         Publisher(std::string topic, NodeHandler *nh, int maxSize = 1);
+        void start() override;
+        std::string type_name() override {
+            return T::descriptor()->full_name();
+        }
         void publish(T msg) {
-            int siz = msg.ByteSize() + 4;
-            char *buf = new char [siz];
-            google::protobuf::io::ArrayOutputStream aos(buf,siz);
-            google::protobuf::io::CodedOutputStream *coded_output = new google::protobuf::io::CodedOutputStream(&aos);
-            coded_output->WriteLittleEndian32(msg.ByteSize());
-            msg.SerializeToCodedStream(coded_output);
-            delete coded_output;
             std::lock_guard<std::mutex> lock(this->queue_mutex_);
-            if (msg_queue.size() >= maxSize) msg_queue.pop();
-            msg_queue.push(std::string(buf, siz));
-            delete [] buf;
+            this->send(msg);
+            /* nobody connected yet, keep the latest messages for the first subscriber */
+            if (this->channels.empty()) {
+                if (msg_queue.size() >= (size_t)maxSize) msg_queue.pop();
+                msg_queue.push(msg);
+            }
         }
-        void call(std::string &ip, uint32_t &port, float &freq) override {
-            bool ret = false;
-            std::shared_ptr<ClientSocket> c_sock = std::make_shared<ClientSocket>(ret);
-            
-            if (ret) {
-                ret = c_sock->Connect(ip, port);
-                if (ret){
-                    /* Path 2 for create publisher client*/
-                    std::cout << "Successful Connected from publisher to subscriber " << ip << ":" << port << "\n";
-                    std::thread publish_thread_ = std::thread([this, c_sock, freq]() {
-                        Rate rate(freq);
-                        while (1) {
-                            std::string msg;
-                            {
-                                std::lock_guard<std::mutex> lock(this->queue_mutex_);
-                                if (this->msg_queue.size() > 0) {
-                                    msg = this->msg_queue.front();
-                                    this->msg_queue.pop();
-                                    if (!c_sock->Send(msg)) break;
-                                }
-                            }
-                            // c_sock->Send(msg);
-                            rate.sleep();
-                        }
-                        c_sock->disconnect();
-                    });
-                    publish_thread_.detach();
+        void call(SubscriberRequest &request) override {
+            /* Path 2 for create publisher client*/
+            this->connect_subscriber(request);
+        }
+        std::string filter_error(const google::protobuf::RepeatedPtrField<FieldFilter> &filters) override {
+            return CompiledFilter(T::descriptor(), filters).error();
+        }
+        void connect(const EndPoint &subscriber) override;
+        /* the subscribers on that node are gone, stop queueing for them */
+        void evicted(const EndPoint &endpoint) override {
+            std::lock_guard<std::mutex> lock(this->queue_mutex_);
+            this->drop_node(peer_key(endpoint));
+        }
+        private:
+        struct SubscriberChannel {
+            std::shared_ptr<OutChannel> channel;
+            std::shared_ptr<CompiledFilter> filter;
+            std::string key;
+            /* peer_key() of the subscriber's node */
+            std::string node;
+        };
+        /* serialize at most once, only if some subscriber's filter accepts the message */
+        void send(const T &msg) {
+            Frame frame;
+            for (auto iter = this->channels.begin(); iter != this->channels.end();) {
+                if (!iter->filter->matches(msg)) {
+                    iter++;
+                    continue;
                 }
+                if (!frame) frame = std::make_shared<const std::string>(msg.SerializeAsString());
+                if (iter->channel->push(frame)) iter++;
+                else {
+                    this->matches.remove(iter->key);
+                    iter = this->channels.erase(iter);
+                }
+            }
+        }
+        void drop_node(const std::string &node) {
+            for (auto iter = this->channels.begin(); iter != this->channels.end();) {
+                if (iter->node != node) {
+                    iter++;
+                    continue;
+                }
+                iter->channel->close();
+                this->matches.remove(iter->key);
+                iter = this->channels.erase(iter);
+            }
+        }
+        void connect_subscriber(const SubscriberRequest &request);
+        NodeHandler* nh_;
+        std::mutex queue_mutex_;
+        std::queue<T> msg_queue;
+        std::vector<SubscriberChannel> channels;
+        std::string topic_name;
+        int maxSize = 1;
+    };
+    /*
+     * publisher of already serialized messages (playback, relays).
+     * descriptor is only needed to evaluate subscriber filters, without it every subscriber gets everything.
+     */
+    class RawPublisher : public Communicator {
+        public:
+        RawPublisher(std::string topic, std::string type_name, const google::protobuf::Descriptor *descriptor, NodeHandler *nh, int maxSize = 1);
+        void start() override;
+        std::string type_name() override {
+            return this->type_name_;
+        }
+        void publish(const char *data, size_t size) {
+            std::lock_guard<std::mutex> lock(this->queue_mutex_);
+            Frame frame = std::make_shared<const std::string>(data, size);
+            this->send(frame);
+            if (this->channels.empty()) {
+                if (msg_queue.size() >= (size_t)maxSize) msg_queue.pop();
+                msg_queue.push(frame);
             }
         }
+        /* waits until the links wrote out everything published so far, false if timeout passed first */
+        bool drain(std::chrono::milliseconds timeout) {
+            std::vector<std::shared_ptr<OutChannel> > pending;
+            {
+                std::lock_guard<std::mutex> lock(this->queue_mutex_);
+                for (auto &channel : this->channels) pending.push_back(channel.channel);
+            }
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            for (auto &channel : pending) {
+                if (!channel->drain(deadline)) return false;
+            }
+            return true;
+        }
+        void call(SubscriberRequest &request) override {
+            this->connect_subscriber(request);
+        }
+        /* without a descriptor filters are ignored, not refused */
+        std::string filter_error(const google::protobuf::RepeatedPtrField<FieldFilter> &filters) override {
+            return this->descriptor ? CompiledFilter(this->descriptor, filters).error() : "";
+        }
+        void connect(const EndPoint &subscriber) override;
+        /* the subscribers on that node are gone, stop queueing for them */
+        void evicted(const EndPoint &endpoint) override {
+            std::lock_guard<std::mutex> lock(this->queue_mutex_);
+            this->drop_node(peer_key(endpoint));
+        }
         private:
+        struct SubscriberChannel {
+            std::shared_ptr<OutChannel> channel;
+            std::shared_ptr<CompiledFilter> filter;
+            std::string key;
+            /* peer_key() of the subscriber's node */
+            std::string node;
+        };
+        /* the frame is only parsed when some subscriber has a filter */
+        void send(const Frame &frame) {
+            std::unique_ptr<google::protobuf::Message> msg;
+            bool parsed = false;
+            for (auto iter = this->channels.begin(); iter != this->channels.end();) {
+                if (iter->filter && !iter->filter->empty()) {
+                    if (!parsed) {
+                        parsed = true;
+                        msg.reset(this->prototype->New());
+                        if (!msg->ParseFromString(*frame)) msg.reset();
+                    }
+                    if (!msg || !iter->filter->matches(*msg)) {
+                        iter++;
+                        continue;
+                    }
+                }
+                if (iter->channel->push(frame)) iter++;
+                else {
+                    this->matches.remove(iter->key);
+                    iter = this->channels.erase(iter);
+                }
+            }
+        }
+        void drop_node(const std::string &node) {
+            for (auto iter = this->channels.begin(); iter != this->channels.end();) {
+                if (iter->node != node) {
+                    iter++;
+                    continue;
+                }
+                iter->channel->close();
+                this->matches.remove(iter->key);
+                iter = this->channels.erase(iter);
+            }
+        }
+        void connect_subscriber(const SubscriberRequest &request);
         NodeHandler* nh_;
+        const google::protobuf::Descriptor *descriptor;
+        const google::protobuf::Message *prototype;
+        std::unique_ptr<google::protobuf::DynamicMessageFactory> factory;
+        std::string type_name_;
         std::mutex queue_mutex_;
-        std::queue<std::string> msg_queue;
+        std::queue<Frame> msg_queue;
+        std::vector<SubscriberChannel> channels;
         std::string topic_name;
         int maxSize = 1;
     };
+    inline std::chrono::system_clock::time_point &currentDeadline() {
+        static thread_local std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max();
+        return deadline;
+    }
+    /* in a service callback: when its caller stops waiting, time_point::max() if it waits forever.
+       Calls the callback makes to other services inherit it */
+    inline std::chrono::system_clock::time_point callDeadline() {
+        return currentDeadline();
+    }
+    /* in a service callback: the caller gave up, the reply would be thrown away */
+    inline bool deadlineExceeded() {
+        return std::chrono::system_clock::now() > currentDeadline();
+    }
+    /* the deadline of the call running on this thread while the scope lasts */
+    class DeadlineScope {
+        public:
+        DeadlineScope(std::chrono::system_clock::time_point deadline) : previous(currentDeadline()) {
+            currentDeadline() = deadline;
+        }
+        ~DeadlineScope() {
+            currentDeadline() = this->previous;
+        }
+        private:
+        std::chrono::system_clock::time_point previous;
+    };
+    class InvalidationReactor;
+    /* the caching clients of a service server, each watching over its own WatchInvalidations call */
+    class CacheWatchers {
+        public:
+        void add(InvalidationReactor *watcher);
+        void remove(InvalidationReactor *watcher);
+        void notify();
+        private:
+        std::mutex mutex_;
+        std::set<InvalidationReactor*> watchers;
+    };
+    /*
+     * one WatchInvalidations call, open as long as the client caches. Invalidations that come while
+     * one is being written collapse into one more write, the client only needs to know there was one.
+     */
+    class InvalidationReactor final : public grpc::ServerWriteReactor<Invalidation> {
+        public:
+        InvalidationReactor(CacheWatchers *watchers, uint32_t service_id) : watchers(watchers) {
+            this->invalidation.set_service_id(service_id);
+            if (!watchers) {
+                this->finished = true;
+                this->Finish(Status(grpc::StatusCode::UNAVAILABLE, "no such service"));
+                return;
+            }
+            watchers->add(this);
+        }
+        void notify() {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            if (this->finished) return;
+            if (this->writing) {
+                this->pending = true;
+                return;
+            }
+            this->writing = true;
+            lock.unlock();
+            this->StartWrite(&this->invalidation);
+        }
+        void OnWriteDone(bool ok) override {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->writing = false;
+            if (!ok || !this->pending || this->finished) return;
+            this->pending = false;
+            this->writing = true;
+            lock.unlock();
+            this->StartWrite(&this->invalidation);
+        }
+        void OnCancel() override {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->finished) return;
+                this->finished = true;
+            }
+            this->Finish(Status::CANCELLED);
+        }
+        void OnDone() override {
+            if (this->watchers) this->watchers->remove(this);
+            delete this;
+        }
+        private:
+        CacheWatchers *watchers;
+        Invalidation invalidation;
+        std::mutex mutex_;
+        bool writing = false;
+        bool pending = false;
+        bool finished = false;
+    };
+    void CacheWatchers::add(InvalidationReactor *watcher) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->watchers.insert(watcher);
+    }
+    void CacheWatchers::remove(InvalidationReactor *watcher) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->watchers.erase(watcher);
+    }
+    /* under mutex_, so no watcher is deleted while it is told */
+    void CacheWatchers::notify() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (InvalidationReactor *watcher : this->watchers) watcher->notify();
+    }
+    /* how a ServiceServer runs its callback */
+    struct ServiceOptions {
+        /* calls running at once, above 1 the callback must be thread safe */
+        size_t concurrency = 1;
+        /* calls waiting for a free worker, further calls fail right away with RESOURCE_EXHAUSTED */
+        size_t max_queue = 64;
+    };
+    /* 32 bit FNV-1a of the service name, identifies the service in a CallRequest */
+    inline uint32_t serviceId(const std::string &service) {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : service) {
+            hash ^= c;
+            hash *= 16777619u;
+        }
+        return hash;
+    }
     template<class RequestT, class ReplyT>
     class ServiceServer : public Communicator {
         using FunctionType = void(*)(RequestT, ReplyT&);
         public:
-        ServiceServer(std::string service, void(*func) (RequestT, ReplyT&), NodeHandler* nh);
-        virtual void request_handler(google::protobuf::Any request, ServingReply &reply) override {
+        ServiceServer(std::string service, void(*func) (RequestT, ReplyT&), NodeHandler* nh, ServiceOptions options = ServiceOptions());
+        /* the workers run the callback against the members below */
+        ~ServiceServer() {
+            this->workers.stop();
+        }
+        /* Serving, for clients that still send Any */
+        virtual void request_handler(const google::protobuf::Any &request, ServingReply &reply) override {
             RequestT request_payload;
             ReplyT reply_payload;
             request.UnpackTo(&request_payload);
-            this->cb_func(request_payload, reply_payload);
+            this->serve(std::move(request_payload), reply_payload);
             reply.mutable_payload()->PackFrom(reply_payload);
         }
+        bool handle(const std::string &request, std::string &reply) override {
+            RequestT request_payload;
+            ReplyT reply_payload;
+            if (!request_payload.ParseFromString(request)) return false;
+            this->serve(std::move(request_payload), reply_payload);
+            return reply_payload.SerializeToString(&reply);
+        }
+        bool dispatch(std::function<void()> job) override {
+            return this->workers.submit(std::move(job));
+        }
+        size_t concurrency() override {
+            return this->workers.size();
+        }
+        CacheWatchers *cache_watchers() override {
+            return &this->watchers;
+        }
+        /* tells every caching client to drop the replies it cached from this service */
+        void invalidate() {
+            this->watchers.notify();
+        }
+        /* invalidate() after each call whose request writes accepts (e.g. mode == WRITE), set before the clients call */
+        void invalidate_when(std::function<bool(const RequestT &request)> writes) {
+            this->writes = writes;
+        }
+        /* an in-process client's call, on the caller's thread. It waits for a free worker slot only until
+           the caller's callDeadline() and is false if none freed up. The callback itself is never cut
+           short: past the deadline it can only notice through deadlineExceeded() and return early. A
+           callback calling its own service in-process without a deadline waits for itself forever */
+        bool call(const RequestT &request, ReplyT &reply) {
+            return this->workers.run([&]() { this->serve(request, reply); }, callDeadline());
+        }
+        /* an in-process client's asynchronous call, on the workers; false if the backlog is full.
+           Not served if the deadline passed while it waited, done tells from deadlineExceeded() */
+        bool post(const RequestT &request, std::chrono::system_clock::time_point deadline, std::function<void(const ReplyT &reply)> done) {
+            return this->workers.submit([this, request, deadline, done]() {
+                DeadlineScope scope(deadline);
+                ReplyT reply;
+                if (!deadlineExceeded()) this->serve(request, reply);
+                done(reply);
+            });
+        }
         private:
+        void serve(RequestT request, ReplyT &reply) {
+            bool write = this->writes && this->writes(request);
+            this->cb_func(std::move(request), reply);
+            if (write) this->invalidate();
+        }
+        WorkerPool workers;
+        CacheWatchers watchers;
+        std::function<bool(const RequestT &request)> writes;
         FunctionType cb_func;
         std::string service_name;
         NodeHandler *nh_;
@@ -142,76 +617,633 @@ namespace core {
     template<class RequestT, class ReplyT>
     class ServiceClient : public Communicator {
         public:
-        ServiceClient(std::string service, NodeHandler* nh);
-        bool pull_request(RequestT request, ReplyT &reply) {
-            std::lock_guard<std::mutex> lock(this->mutex_);
-            if (!connected) return false;
-            ServingRequest send_request;
-            ServingReply send_reply;
-            send_request.set_service_name(this->service_name);
-            send_request.mutable_payload()->PackFrom(request);
-            ClientContext serving_context_;
-            Status status = stub->Serving(&serving_context_, send_request, &send_reply);
-            if (status.ok()) {
-                send_reply.payload().UnpackTo(&reply);;
+        ServiceClient(std::string service, NodeHandler* nh, Balance balance = Balance::ROUND_ROBIN);
+        /* deadline of each call from now on, zero (the default) waits as long as the server takes */
+        void set_timeout(std::chrono::milliseconds timeout) {
+            this->timeout_ms = timeout.count();
+        }
+        /* may be called from several threads at once, each call goes to the server balance picks */
+        bool pull_request(const RequestT &request, ReplyT &reply) {
+            return this->pull_request(request, reply, std::chrono::milliseconds(this->timeout_ms));
+        }
+        /* false once timeout passed, the server's callback sees the deadline through callDeadline() */
+        bool pull_request(const RequestT &request, ReplyT &reply, std::chrono::milliseconds timeout) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::chrono::system_clock::time_point deadline = this->deadline_for(timeout);
+            std::shared_ptr<ServiceServer<RequestT, ReplyT> > local = std::atomic_load(&this->local_);
+            if (local) {
+                Status status;
+                {
+                    DeadlineScope scope(deadline);
+                    bool served = !deadlineExceeded() && local->call(request, reply);
+                    status = served ? local_status() : Status(grpc::StatusCode::DEADLINE_EXCEEDED, "deadline exceeded");
+                }
+                this->record(start, status);
+                return status.ok();
+            }
+            CallRequest call_request;
+            CallReply call_reply;
+            call_request.set_service_id(this->service_id);
+            request.SerializeToString(call_request.mutable_payload());
+            CacheTicket ticket;
+            if (this->cache_begin(request, call_request.payload(), reply, ticket)) {
+                this->cache_hits_++;
                 return true;
             }
-            else return false;
+            ServerPool::ServerPtr server = this->servers.pick();
+            if (!server) {
+                this->failures_++;
+                return false;
+            }
+            ClientContext call_context;
+            if (deadline != std::chrono::system_clock::time_point::max()) call_context.set_deadline(deadline);
+            Status status = server->stub->Call(&call_context, call_request, &call_reply);
+            this->servers.done(server);
+            this->record(start, status);
+            bool ok = status.ok() && reply.ParseFromString(call_reply.payload());
+            this->cache_end(ticket, call_request.payload(), ok ? &call_reply.payload() : nullptr);
+            return ok;
+        }
+        /* replies to the requests cacheable accepts (idempotent reads) are reused for ttl. They are dropped
+           by invalidate(), by any other call through this client (once it is sent and again once it is
+           answered), and whenever a server pushes an invalidation; ttl bounds how stale a reply gets if
+           such a push is lost. Not for in-process servers. false, and nothing changes, without cacheable */
+        bool enable_cache(std::chrono::milliseconds ttl, std::function<bool(const RequestT &request)> cacheable) {
+            if (!cacheable) {
+                std::cerr << "Service " << this->service_name << ": enable_cache needs a cacheable predicate\n";
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->cache_mutex_);
+                this->cache_ttl = ttl;
+                this->cacheable = cacheable;
+                this->cache.clear();
+            }
+            if (this->cache_enabled.exchange(true)) return true;
+            for (const EndPoint &server : this->known_servers()) this->watch_invalidations(server);
+            return true;
+        }
+        void invalidate() {
+            std::lock_guard<std::mutex> lock(this->cache_mutex_);
+            this->cache.clear();
+            this->cache_generation++;
+        }
+        void invalidate(const RequestT &request) {
+            std::lock_guard<std::mutex> lock(this->cache_mutex_);
+            this->cache.erase(request.SerializeAsString());
+            this->cache_generation++;
+        }
+        /* calls answered from the cache */
+        uint64_t cache_hits() const {
+            return this->cache_hits_;
+        }
+        /* all requests in one round trip, replies in the same order. in_order runs them one after
+           another on the server, otherwise up to the server's concurrency at once */
+        bool pull_batch(const std::vector<RequestT> &requests, std::vector<ReplyT> &replies, bool in_order = true) {
+            replies.clear();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::chrono::system_clock::time_point deadline = this->deadline_for(std::chrono::milliseconds(this->timeout_ms));
+            std::shared_ptr<ServiceServer<RequestT, ReplyT> > local = std::atomic_load(&this->local_);
+            if (local) {
+                Status status;
+                replies.resize(requests.size());
+                {
+                    DeadlineScope scope(deadline);
+                    bool served = true;
+                    for (size_t i = 0; i < requests.size() && served; i++) served = !deadlineExceeded() && local->call(requests[i], replies[i]);
+                    status = served ? local_status() : Status(grpc::StatusCode::DEADLINE_EXCEEDED, "deadline exceeded");
+                }
+                this->record(start, status);
+                if (!status.ok()) replies.clear();
+                return status.ok();
+            }
+            CallBatchRequest batch_request;
+            CallBatchReply batch_reply;
+            batch_request.set_service_id(this->service_id);
+            batch_request.set_in_order(in_order);
+            for (const RequestT &request : requests) request.SerializeToString(batch_request.add_payloads());
+            /* the cache only answers a batch it holds every reply of */
+            std::vector<CacheTicket> tickets(requests.size());
+            replies.resize(requests.size());
+            bool hit = true;
+            for (size_t i = 0; i < requests.size(); i++) {
+                if (!this->cache_begin(requests[i], batch_request.payloads(i), replies[i], tickets[i])) hit = false;
+            }
+            if (hit && !requests.empty()) {
+                this->cache_hits_ += requests.size();
+                return true;
+            }
+            replies.clear();
+            ServerPool::ServerPtr server = this->servers.pick();
+            if (!server) {
+                this->failures_++;
+                return false;
+            }
+            ClientContext batch_context;
+            if (deadline != std::chrono::system_clock::time_point::max()) batch_context.set_deadline(deadline);
+            Status status = server->stub->CallBatch(&batch_context, batch_request, &batch_reply);
+            this->servers.done(server);
+            this->record(start, status);
+            bool ok = status.ok() && batch_reply.payloads_size() == (int)requests.size();
+            if (ok) replies.resize(requests.size());
+            for (size_t i = 0; i < requests.size(); i++) {
+                bool parsed = ok && replies[i].ParseFromString(batch_reply.payloads(i));
+                this->cache_end(tickets[i], batch_request.payloads(i), parsed ? &batch_reply.payloads(i) : nullptr);
+                ok = parsed;
+            }
+            return ok;
+        }
+        using Callback = std::function<void(bool ok, const ReplyT &reply)>;
+        /* returns at once, any number of calls may be in flight over the same channel.
+           done runs on a gRPC thread when the reply arrived (ok) or the call failed, keep it short */
+        void callAsync(const RequestT &request, Callback done) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::chrono::system_clock::time_point deadline = this->deadline_for(std::chrono::milliseconds(this->timeout_ms));
+            std::shared_ptr<ServiceServer<RequestT, ReplyT> > local = std::atomic_load(&this->local_);
+            if (local) {
+                bool posted = local->post(request, deadline, [this, start, done](const ReplyT &reply) {
+                    Status status = local_status();
+                    this->record(start, status);
+                    done(status.ok(), reply);
+                });
+                if (!posted) {
+                    this->record(start, Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "too many calls waiting"));
+                    done(false, ReplyT());
+                }
+                return;
+            }
+            struct Call {
+                ClientContext context;
+                CallRequest request;
+                CallReply reply;
+                std::chrono::steady_clock::time_point start;
+                CacheTicket ticket;
+            };
+            std::shared_ptr<Call> call = std::make_shared<Call>();
+            call->request.set_service_id(this->service_id);
+            request.SerializeToString(call->request.mutable_payload());
+            ReplyT cached;
+            if (this->cache_begin(request, call->request.payload(), cached, call->ticket)) {
+                this->cache_hits_++;
+                done(true, cached);
+                return;
+            }
+            ServerPool::ServerPtr server = this->servers.pick();
+            if (!server) {
+                this->failures_++;
+                done(false, ReplyT());
+                return;
+            }
+            call->start = start;
+            if (deadline != std::chrono::system_clock::time_point::max()) call->context.set_deadline(deadline);
+            server->stub->async()->Call(&call->context, &call->request, &call->reply, [this, call, server, done](Status status) {
+                this->servers.done(server);
+                this->record(call->start, status);
+                ReplyT reply;
+                bool ok = status.ok() && reply.ParseFromString(call->reply.payload());
+                this->cache_end(call->ticket, call->request.payload(), ok ? &call->reply.payload() : nullptr);
+                done(ok, reply);
+            });
+        }
+        /* get() throws std::runtime_error if the call failed */
+        std::future<ReplyT> callAsync(const RequestT &request) {
+            std::shared_ptr<std::promise<ReplyT> > promise = std::make_shared<std::promise<ReplyT> >();
+            std::string service = this->service_name;
+            this->callAsync(request, [promise, service](bool ok, const ReplyT &reply) {
+                if (ok) promise->set_value(reply);
+                else promise->set_exception(std::make_exception_ptr(std::runtime_error("call to service " + service + " failed")));
+            });
+            return promise->get_future();
+        }
+        /* time until the answer or the failure of every call that reached a server, in-process and timed
+           out ones included. Cache hits and calls that found no server are not recorded */
+        const LatencyHistogram &latencies() const {
+            return this->latencies_;
+        }
+        /* calls that ran past their deadline */
+        uint64_t timeouts() const {
+            return this->timeouts_;
+        }
+        /* calls that failed otherwise: no server, server unreachable, busy or rejecting the request */
+        uint64_t failures() const {
+            return this->failures_;
+        }
+        void connect(const EndPoint &server) override;
+        /* stop calling a dead server right away instead of waiting for its connect timeout */
+        void evicted(const EndPoint &endpoint) override {
+            std::string server = peer_key(endpoint);
+            {
+                std::lock_guard<std::mutex> lock(this->cache_mutex_);
+                this->endpoints.erase(server);
+            }
+            if (!this->servers.remove(server)) return;
+            std::cout << "Service " << this->service_name << " lost its server " << server << "\n";
+            this->matches.remove(server);
         }
         private:
+        /* the sooner of now + timeout and the deadline of the service call we are made from */
+        static std::chrono::system_clock::time_point deadline_for(std::chrono::milliseconds timeout) {
+            std::chrono::system_clock::time_point deadline = callDeadline();
+            if (timeout.count() > 0) deadline = std::min(deadline, std::chrono::system_clock::now() + timeout);
+            return deadline;
+        }
+        static const size_t CACHE_MAX_ENTRIES = 1024;
+        /* how one request goes through the cache, from cache_begin() to cache_end() */
+        struct CacheTicket {
+            bool read = false;
+            bool write = false;
+            uint64_t generation = 0;
+        };
+        /* true if the cache answers request (payload is its serialized form). Otherwise a read cacheable
+           accepts notes the generation its reply is stored under, anything else is a write: the cache is
+           invalidated now and again in cache_end(), so a read that overtook the write is not stored */
+        bool cache_begin(const RequestT &request, const std::string &payload, ReplyT &reply, CacheTicket &ticket) {
+            if (!this->cache_enabled) return false;
+            std::function<bool(const RequestT &request)> cacheable;
+            {
+                std::lock_guard<std::mutex> lock(this->cache_mutex_);
+                cacheable = this->cacheable;
+            }
+            ticket.read = cacheable(request);
+            ticket.write = !ticket.read;
+            if (ticket.write) {
+                this->invalidate();
+                return false;
+            }
+            return this->cache_lookup(payload, reply, ticket.generation);
+        }
+        /* once the call cache_begin() did not answer is over, reply is nullptr if it failed */
+        void cache_end(const CacheTicket &ticket, const std::string &payload, const std::string *reply) {
+            if (ticket.write) this->invalidate();
+            else if (ticket.read && reply) this->cache_store(payload, *reply, ticket.generation);
+        }
+        /* generation is where the cache stood, a reply is only stored if nothing was invalidated since */
+        bool cache_lookup(const std::string &request, ReplyT &reply, uint64_t &generation) {
+            std::lock_guard<std::mutex> lock(this->cache_mutex_);
+            generation = this->cache_generation;
+            auto iter = this->cache.find(request);
+            if (iter == this->cache.end()) return false;
+            if (std::chrono::steady_clock::now() > iter->second.expiry || !reply.ParseFromString(iter->second.reply)) {
+                this->cache.erase(iter);
+                return false;
+            }
+            return true;
+        }
+        void cache_store(const std::string &request, const std::string &reply, uint64_t generation) {
+            std::lock_guard<std::mutex> lock(this->cache_mutex_);
+            if (generation != this->cache_generation) return;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (this->cache.size() >= CACHE_MAX_ENTRIES) {
+                for (auto iter = this->cache.begin(); iter != this->cache.end();) {
+                    if (now > iter->second.expiry) iter = this->cache.erase(iter);
+                    else iter++;
+                }
+                if (this->cache.size() >= CACHE_MAX_ENTRIES) this->cache.clear();
+            }
+            CacheEntry &entry = this->cache[request];
+            entry.reply = reply;
+            entry.expiry = now + this->cache_ttl;
+        }
+        std::vector<EndPoint> known_servers() {
+            std::lock_guard<std::mutex> lock(this->cache_mutex_);
+            std::vector<EndPoint> known;
+            for (auto &pair : this->endpoints) known.push_back(pair.second);
+            return known;
+        }
+        /* every invalidation the server pushes clears the cache; so does losing the stream, after which
+           it is opened again for as long as the server is known and the node runs */
+        void watch_invalidations(const EndPoint &server);
+        /* an in-process call fails like a remote one once its deadline passed, in the callee's DeadlineScope */
+        static Status local_status() {
+            if (deadlineExceeded()) return Status(grpc::StatusCode::DEADLINE_EXCEEDED, "deadline exceeded");
+            return Status::OK;
+        }
+        void record(std::chrono::steady_clock::time_point start, const Status &status) {
+            this->latencies_.record(std::chrono::steady_clock::now() - start);
+            if (status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED) this->timeouts_++;
+            else if (!status.ok()) this->failures_++;
+        }
         std::string service_name;
-        std::unique_ptr<ServerClient::Stub> stub;
+        uint32_t service_id;
         NodeHandler *nh_;
-        bool connected;
+        ServerPool servers;
+        std::atomic<int64_t> timeout_ms{0};
+        LatencyHistogram latencies_;
+        std::atomic<uint64_t> timeouts_{0};
+        std::atomic<uint64_t> failures_{0};
+        struct CacheEntry {
+            std::string reply;
+            std::chrono::steady_clock::time_point expiry;
+        };
+        std::atomic<bool> cache_enabled{false};
+        std::function<bool(const RequestT &request)> cacheable;
+        std::chrono::milliseconds cache_ttl{0};
+        std::mutex cache_mutex_;
+        /* by serialized request */
+        std::unordered_map<std::string, CacheEntry> cache;
+        uint64_t cache_generation = 0;
+        std::atomic<uint64_t> cache_hits_{0};
+        /* the servers found so far by peer_key, whose invalidations are watched once caching */
+        std::map<std::string, EndPoint> endpoints;
+        /* a server of the service in this very node, called directly instead of over gRPC */
+        std::shared_ptr<ServiceServer<RequestT, ReplyT> > local_;
+    };
+    /* handed to an action's callback: progress out, cancellation in */
+    template<class FeedbackT>
+    class ActionHandle {
+        public:
+        ActionHandle(ActionStream &stream) : stream(stream) {}
+        /* the client cancelled or went away, the callback should stop and return soon */
+        bool cancelled() {
+            return this->stream.cancelled();
+        }
+        /* never blocks: while an earlier feedback is still being sent only the newest one is kept */
+        void feedback(const FeedbackT &feedback) {
+            this->stream.feedback(feedback.SerializeAsString());
+        }
+        private:
+        ActionStream &stream;
+    };
+    /* a service whose callback runs until the goal is reached, reporting feedback on the way */
+    template<class GoalT, class FeedbackT, class ResultT>
+    class ActionServer : public Communicator {
+        using FunctionType = void(*)(GoalT, ActionHandle<FeedbackT>&, ResultT&);
+        public:
+        ActionServer(std::string action, void(*func) (GoalT, ActionHandle<FeedbackT>&, ResultT&), NodeHandler* nh, ServiceOptions options = ServiceOptions());
+        ~ActionServer() {
+            this->workers.stop();
+        }
+        bool execute(const std::string &goal, ActionStream &stream, std::string &result) override {
+            GoalT goal_payload;
+            ResultT result_payload;
+            if (!goal_payload.ParseFromString(goal)) return false;
+            ActionHandle<FeedbackT> handle(stream);
+            this->cb_func(std::move(goal_payload), handle, result_payload);
+            return result_payload.SerializeToString(&result);
+        }
+        bool dispatch(std::function<void()> job) override {
+            return this->workers.submit(std::move(job));
+        }
+        size_t concurrency() override {
+            return this->workers.size();
+        }
+        private:
+        WorkerPool workers;
+        FunctionType cb_func;
+        std::string action_name;
+        NodeHandler *nh_;
+    };
+    /* one goal sent by an ActionClient */
+    template<class ResultT>
+    class GoalHandle {
+        public:
+        /* asks the server to stop the action, wait() then returns false */
+        void cancel() {
+            this->context.TryCancel();
+        }
+        bool done() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->finished;
+        }
+        /* blocks until the action ended; true with its result if it completed */
+        bool wait(ResultT &result) {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->cv_.wait(lock, [this]() { return this->finished; });
+            return this->ok && result.ParseFromString(this->result);
+        }
+        /* false if the action did not end within timeout */
+        bool wait_for(std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            return this->cv_.wait_for(lock, timeout, [this]() { return this->finished; });
+        }
+        void finish(bool ok, const std::string &result) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->finished = true;
+                this->ok = ok;
+                this->result = result;
+            }
+            this->cv_.notify_all();
+        }
+        ClientContext context;
+        private:
         std::mutex mutex_;
+        std::condition_variable cv_;
+        bool finished = false;
+        bool ok = false;
+        std::string result;
+    };
+    template<class GoalT, class FeedbackT, class ResultT>
+    class ActionClient : public Communicator {
+        public:
+        using Feedback = std::function<void(const FeedbackT &feedback)>;
+        ActionClient(std::string action, NodeHandler* nh, Balance balance = Balance::ROUND_ROBIN);
+        /* returns at once, the action runs on the server picked by balance. feedback runs on a thread of
+           this goal, one at a time; the result is taken from the handle */
+        std::shared_ptr<GoalHandle<ResultT> > send_goal(const GoalT &goal, Feedback feedback = nullptr) {
+            std::shared_ptr<GoalHandle<ResultT> > handle = std::make_shared<GoalHandle<ResultT> >();
+            ServerPool::ServerPtr server = this->servers.pick();
+            if (!server) {
+                handle->finish(false, "");
+                return handle;
+            }
+            ActionGoal request;
+            request.set_action_id(this->action_id);
+            goal.SerializeToString(request.mutable_goal());
+            std::thread([this, handle, server, request, feedback]() {
+                std::unique_ptr<grpc::ClientReader<ActionUpdate> > reader(server->stub->Act(&handle->context, request));
+                ActionUpdate update;
+                std::string result;
+                bool completed = false;
+                while (reader->Read(&update)) {
+                    if (update.update_case() == ActionUpdate::kResult) {
+                        result = update.result();
+                        completed = true;
+                    }
+                    else if (feedback) {
+                        FeedbackT feedback_payload;
+                        if (feedback_payload.ParseFromString(update.feedback())) feedback(feedback_payload);
+                    }
+                }
+                Status status = reader->Finish();
+                this->servers.done(server);
+                handle->finish(status.ok() && completed, result);
+            }).detach();
+            return handle;
+        }
+        /* sends the goal and waits for its end, false if it failed or was cancelled */
+        bool pull_result(const GoalT &goal, ResultT &result, Feedback feedback = nullptr) {
+            return this->send_goal(goal, feedback)->wait(result);
+        }
+        void connect(const EndPoint &server) override;
+        void evicted(const EndPoint &endpoint) override {
+            std::string server = peer_key(endpoint);
+            if (!this->servers.remove(server)) return;
+            std::cout << "Action " << this->action_name << " lost its server " << server << "\n";
+            this->matches.remove(server);
+        }
+        private:
+        std::string action_name;
+        uint32_t action_id;
+        NodeHandler *nh_;
+        ServerPool servers;
     };
     class NodeHandler {
         public:
         NodeHandler();
+        ~NodeHandler();
+        /* freq caps how often each publisher sends us this topic (newest sample wins), freq <= 0 receives every message */
+        /* filter is evaluated by the publishers, messages it rejects are never sent to us.
+           flow picks what a publisher does once we stop granting credits (default: keep its newest maxSize) */
         template<class T>
-        Subscriber<T>& subscribe(std::string topic, float freq, void (*func)(T), int maxSize = 1) {
-            std::shared_ptr<Subscriber<T> > sub = std::make_shared<Subscriber<T> >(topic, freq, func, this, maxSize);
-            std::lock_guard<std::mutex> lock(mutex_);
-            this->subscribers[topic] = sub;
-            usleep(100000);
+        Subscriber<T>& subscribe(std::string topic, float freq, void (*func)(T), int maxSize = 1, Filter filter = Filter(), FlowControl flow = FlowControl()) {
+            std::shared_ptr<Subscriber<T> > sub = std::make_shared<Subscriber<T> >(topic, freq, func, this, maxSize, filter, flow);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                this->subscribers[topic] = sub;
+            }
+            /* registered only now, so no handshake arrives before the topic can be found */
+            sub->start();
+            return *sub;
+        }
+        /* the topic's serialized messages and type name, without knowing the type at compile time */
+        RawSubscriber& subscribeRaw(std::string topic, RawCallback func, float freq = 0, Filter filter = Filter(), FlowControl flow = FlowControl()) {
+            std::shared_ptr<RawSubscriber> sub = std::make_shared<RawSubscriber>(topic, func, this, freq, filter, flow);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                this->subscribers[topic] = sub;
+            }
+            /* registered only now, so no handshake arrives before the topic can be found */
+            sub->start();
             return *sub;
         }
         template<class T>
         Publisher<T>& advertise(std::string topic, int maxSize = 1) {
             std::shared_ptr<Publisher<T> > pub =  std::make_shared<Publisher<T> >(topic, this, maxSize);
-            std::lock_guard<std::mutex> lock(mutex_);
-            this->publishers[topic] = pub;
-            usleep(100000);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                this->publishers[topic] = pub;
+            }
+            /* registered only now, so no handshake arrives before the topic can be found */
+            pub->start();
+            return *pub;
+        }
+        /* descriptor defaults to the compiled-in type of that name, if there is one */
+        RawPublisher& advertiseRaw(std::string topic, std::string type_name, int maxSize = 1, const google::protobuf::Descriptor *descriptor = nullptr) {
+            if (!descriptor) descriptor = google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type_name);
+            std::shared_ptr<RawPublisher> pub = std::make_shared<RawPublisher>(topic, type_name, descriptor, this, maxSize);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                this->publishers[topic] = pub;
+            }
+            /* registered only now, so no handshake arrives before the topic can be found */
+            pub->start();
             return *pub;
         }
         template<class RequestT, class ReplyT>
-        ServiceServer<RequestT, ReplyT>& serviceServer(std::string service, void(*func) (RequestT, ReplyT&)) {
-            std::shared_ptr<ServiceServer<RequestT, ReplyT> > srv = std::make_shared<ServiceServer<RequestT, ReplyT> >(service, func, this);
-            std::lock_guard<std::mutex> lock(mutex_);
-            this->service_servers[service] = srv;
-            usleep(100000);
+        /* each service runs its calls on its own workers, see ServiceOptions;
+           throws std::runtime_error if the name has the id of another service */
+        ServiceServer<RequestT, ReplyT>& serviceServer(std::string service, void(*func) (RequestT, ReplyT&), ServiceOptions options = ServiceOptions()) {
+            std::shared_ptr<ServiceServer<RequestT, ReplyT> > srv = std::make_shared<ServiceServer<RequestT, ReplyT> >(service, func, this, options);
+            this->add_service_server(service, srv);
             return *srv;
         }
+        /* actions share the name space of services and run on their own workers as well */
+        template<class GoalT, class FeedbackT, class ResultT>
+        ActionServer<GoalT, FeedbackT, ResultT>& actionServer(std::string action, void(*func) (GoalT, ActionHandle<FeedbackT>&, ResultT&), ServiceOptions options = ServiceOptions()) {
+            std::shared_ptr<ActionServer<GoalT, FeedbackT, ResultT> > srv = std::make_shared<ActionServer<GoalT, FeedbackT, ResultT> >(action, func, this, options);
+            this->add_service_server(action, srv);
+            return *srv;
+        }
+        /* read without mutex_, the map is replaced as a whole when a server is added */
+        std::shared_ptr<Communicator> service_server(uint32_t service_id) {
+            std::shared_ptr<const ServiceMap> servers = std::atomic_load(&this->service_servers);
+            auto iter = servers->find(service_id);
+            return iter == servers->end() ? nullptr : iter->second.server;
+        }
+        std::shared_ptr<Communicator> service_server(const std::string &service) {
+            std::shared_ptr<const ServiceMap> servers = std::atomic_load(&this->service_servers);
+            auto iter = servers->find(serviceId(service));
+            return iter == servers->end() || iter->second.name != service ? nullptr : iter->second.server;
+        }
+        /* balance spreads the calls over the servers of the service */
         template<class RequestT, class ReplyT>
-        ServiceClient<RequestT, ReplyT>& serviceClient(std::string service) {
-            std::shared_ptr<ServiceClient<RequestT, ReplyT> > clt =  std::make_shared<ServiceClient<RequestT, ReplyT> >(service, this);
+        ServiceClient<RequestT, ReplyT>& serviceClient(std::string service, Balance balance = Balance::ROUND_ROBIN) {
+            std::shared_ptr<ServiceClient<RequestT, ReplyT> > clt =  std::make_shared<ServiceClient<RequestT, ReplyT> >(service, this, balance);
             std::lock_guard<std::mutex> lock(mutex_);
             this->service_clients[service] = clt;
-            usleep(100000);
             return *clt;
         }
+        template<class GoalT, class FeedbackT, class ResultT>
+        ActionClient<GoalT, FeedbackT, ResultT>& actionClient(std::string action, Balance balance = Balance::ROUND_ROBIN) {
+            std::shared_ptr<ActionClient<GoalT, FeedbackT, ResultT> > clt = std::make_shared<ActionClient<GoalT, FeedbackT, ResultT> >(action, this, balance);
+            std::lock_guard<std::mutex> lock(mutex_);
+            this->service_clients[action] = clt;
+            return *clt;
+        }
+        /* where to reach a service server: its abstract unix socket on the same host, "" for its tcp endpoint */
+        std::string rpc_target(const EndPoint &server) {
+            if (!server.uds().empty() && server.host_id() == this->host_id) return "unix-abstract:" + server.uds();
+            return "";
+        }
+        /* the node's one channel to peer, shared by all stubs to it; warm starts connecting right away */
+        std::shared_ptr<grpc::Channel> channel(const EndPoint &peer, bool warm = false) {
+            std::string target = this->rpc_target(peer);
+            if (target.empty()) target = peer.ip() + ":" + std::to_string(peer.port());
+            return warm ? this->channel_cache.warm(target) : this->channel_cache.get(target);
+        }
+        /* the topic's endpoint in one of the maps below, nullptr if the node has none */
+        std::shared_ptr<Communicator> find(const std::unordered_map<std::string, std::shared_ptr<Communicator> > &endpoints, const std::string &topic) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            auto iter = endpoints.find(topic);
+            return iter == endpoints.end() ? nullptr : iter->second;
+        }
+        /* heartbeat period is a quarter of the lease, a node is evicted after missing about four */
+        static const uint32_t LEASE_TTL_MS = 2000;
+        /* a cached channel no stub uses any more is closed after this long */
+        static const uint32_t CHANNEL_IDLE_MS = 60000;
+        /* the master, or with CORE_DISCOVERY=multicast the peers directly */
+        std::unique_ptr<Registrar> registrar;
         std::unique_ptr<Registration::Stub> stub_;
         std::unique_ptr<Server> server;
+        std::unique_ptr<LinkManager> links;
+        ChannelCache channel_cache{std::chrono::milliseconds(CHANNEL_IDLE_MS)};
         ConnectionServiceImpl *service;
         ServerClientServiceImpl *service_serve;
         std::unordered_map<std::string, std::shared_ptr<Communicator> > subscribers;
         std::unordered_map<std::string, std::shared_ptr<Communicator> > publishers; 
-        std::unordered_map<std::string, std::shared_ptr<Communicator> > service_servers;
+        struct ServiceEntry {
+            std::string name;
+            std::shared_ptr<Communicator> server;
+        };
+        /* by serviceId() of the name */
+        using ServiceMap = std::unordered_map<uint32_t, ServiceEntry>;
+        std::shared_ptr<const ServiceMap> service_servers;
         std::unordered_map<std::string, std::shared_ptr<Communicator> > service_clients;
         std::mutex mutex_;
         std::string local_ip;
+        std::string host_id;
         int rpc_port;
+        /* abstract unix socket name the rpc server listens on as well */
+        std::string rpc_uds;
         std::string master_addr;
+        /* lease and invalidation watch streams, stopped when the node goes away */
+        StreamThreads streams;
+        private:
+        void add_service_server(const std::string &service, const std::shared_ptr<Communicator> &srv) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::shared_ptr<ServiceMap> servers = std::make_shared<ServiceMap>(*std::atomic_load(&this->service_servers));
+            ServiceEntry &entry = (*servers)[serviceId(service)];
+            if (entry.server && entry.name != service)
+                throw std::runtime_error("Services " + entry.name + " and " + service + " have the same id, rename one of them");
+            entry.name = service;
+            entry.server = srv;
+            std::atomic_store(&this->service_servers, std::shared_ptr<const ServiceMap>(servers));
+            /* announced only now, so no call arrives before the service can be found */
+            this->registrar->serve(service);
+        }
+        void keep_lease();
+        void evicted(const EndPoint &endpoint);
     };
     class ConnectionServiceImpl final : public Connection::Service {
         public:
@@ -219,249 +1251,671 @@ namespace core {
         Status Subscriber(ServerContext* context, const SubscriberRequest* request,
                         SubscriberReply* reply) override {
             std::string topic = request->topic_name();
-            std::string ip = request->tcp_endpoint().ip();
-            uint32_t port = request->tcp_endpoint().port();
-            float freq = request->rate();
-            std::lock_guard<std::mutex> lock(this->nh_->mutex_);
-            this->nh_->publishers[topic]->call(ip, port, freq);
-            std::cout << "Receive from Subscriber " << ip << ":" << port << "\n";
+            SubscriberRequest subscriber_request = *request;
+            /* same host: take the unix domain socket and skip the tcp/ip stack */
+            if (request->host_id() != this->nh_->host_id) subscriber_request.clear_uds_path();
+            std::shared_ptr<Communicator> publisher = this->nh_->find(this->nh_->publishers, topic);
+            if (!publisher) return Status(grpc::StatusCode::NOT_FOUND, "no publisher of " + topic);
+            std::string error = publisher->filter_error(request->filters());
+            if (!error.empty()) return Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+            /* opens the link, the node stays unlocked meanwhile */
+            publisher->call(subscriber_request);
+            reply->set_type_name(publisher->type_name());
+            std::cout << "Receive from Subscriber " << request->tcp_endpoint().ip() << ":" << request->tcp_endpoint().port() << "\n";
             return Status::OK;
         }
         Status Publisher(ServerContext* context, const PublisherRequest* request,
                         PublisherReply* reply) override {
             std::string topic = request->topic_name();
-            std::string ip;
-            uint32_t port;
-            float freq;
-            std::lock_guard<std::mutex> lock(this->nh_->mutex_);
-            this->nh_->subscribers[topic]->call(ip, port, freq);
-            core::EndPoint* endpoint = reply->mutable_tcp_endpoint();
-            endpoint->set_ip(ip);
-            endpoint->set_port(port);
-            reply->set_rate(freq);
+            SubscriberRequest subscriber_request;
+            std::shared_ptr<Communicator> subscriber = this->nh_->find(this->nh_->subscribers, topic);
+            if (!subscriber) return Status(grpc::StatusCode::NOT_FOUND, "no subscriber of " + topic);
+            subscriber->call(subscriber_request);
+            /* our filters are checked here when we know the published type, so the refusal shows on our side */
+            const google::protobuf::Descriptor *descriptor = google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(request->type_name());
+            std::string error = descriptor ? CompiledFilter(descriptor, subscriber_request.filters()).error() : "";
+            if (!error.empty()) {
+                subscriber->refuse(error);
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+            }
+            subscriber->set_type_name(request->type_name());
+            subscriber->linked(request->endpoint());
+            *reply->mutable_tcp_endpoint() = subscriber_request.tcp_endpoint();
+            /* only offer the unix domain socket to a publisher on the same host */
+            if (request->host_id() == this->nh_->host_id) reply->set_uds_path(subscriber_request.uds_path());
+            reply->set_rate(subscriber_request.rate());
+            reply->set_topic_id(subscriber_request.topic_id());
+            *reply->mutable_filters() = subscriber_request.filters();
+            *reply->mutable_flow() = subscriber_request.flow();
             reply->set_topic_name(topic);
-            std::cout << "Receive from Publisher " << ip << ":" << port << "\n";
+            std::cout << "Receive from Publisher " << subscriber_request.tcp_endpoint().ip() << ":" << subscriber_request.tcp_endpoint().port() << "\n";
             return Status::OK;
         }
         private:
         NodeHandler *nh_;
     };
-    class ServerClientServiceImpl final : public ServerClient::Service {
+    /*
+     * one Act call: the action runs on its server's workers and streams its feedback from there.
+     * Only one write is in flight at a time and newer feedback replaces feedback not yet written.
+     * A cancelled call is finished with CANCELLED right away. The action only learns it from
+     * cancelled() and keeps its worker until it returns, what it reports after that is dropped.
+     */
+    class ActionReactor final : public grpc::ServerWriteReactor<ActionUpdate> {
+        public:
+        ActionReactor(const std::shared_ptr<Communicator> &server, const ActionGoal *goal) : job(std::make_shared<Job>(this)) {
+            if (!server) {
+                this->fail(Status(grpc::StatusCode::UNAVAILABLE, "no such action"));
+                return;
+            }
+            /* the job outlives the call, so it keeps its own copy of the goal */
+            std::shared_ptr<Job> job = this->job;
+            std::string data = goal->goal();
+            if (!server->dispatch([server, job, data]() { job->run(*server, data); })) this->fail(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "action is busy"));
+        }
+        void OnWriteDone(bool ok) override {
+            std::unique_lock<std::mutex> lock(this->job->mutex_);
+            this->writing = false;
+            if (!ok) this->job->cancelled_ = true;
+            this->next(lock);
+        }
+        void OnCancel() override {
+            std::unique_lock<std::mutex> lock(this->job->mutex_);
+            this->job->cancelled_ = true;
+            this->next(lock);
+        }
+        void OnDone() override {
+            {
+                std::lock_guard<std::mutex> lock(this->job->mutex_);
+                this->job->reactor = nullptr;
+            }
+            delete this;
+        }
+        private:
+        /* ends a call whose action never ran, through next() so a cancel cannot finish it again */
+        void fail(const Status &status) {
+            std::unique_lock<std::mutex> lock(this->job->mutex_);
+            this->status = status;
+            this->ended = true;
+            this->next(lock);
+        }
+        /* the running action's side of the call, the reactor is gone (nullptr) once the call is done */
+        class Job : public ActionStream {
+            public:
+            Job(ActionReactor *reactor) : reactor(reactor) {}
+            bool cancelled() override {
+                return this->cancelled_;
+            }
+            void feedback(const std::string &feedback) override {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                if (!this->reactor || this->cancelled_) return;
+                this->reactor->pending.set_feedback(feedback);
+                this->reactor->has_pending = true;
+                this->reactor->next(lock);
+            }
+            void run(Communicator &server, const std::string &goal) {
+                std::string result;
+                bool parsed = server.execute(goal, *this, result);
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                if (!this->reactor) return;
+                if (!parsed) this->reactor->status = Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed goal");
+                else if (!this->cancelled_) {
+                    /* feedback not written yet is stale once the result is there */
+                    this->reactor->pending.set_result(result);
+                    this->reactor->has_pending = true;
+                }
+                this->reactor->ended = true;
+                this->reactor->next(lock);
+            }
+            std::mutex mutex_;
+            ActionReactor *reactor;
+            std::atomic<bool> cancelled_{false};
+        };
+        /* with the job's mutex_ held: start the next write, or finish once the action ended (or the
+           call was cancelled) and all is written. gRPC is called after unlocking, after Finish() this may be gone */
+        void next(std::unique_lock<std::mutex> &lock) {
+            if (this->writing || this->finished) return;
+            bool cancelled = this->job->cancelled_;
+            if (this->has_pending && !cancelled) {
+                this->current.Swap(&this->pending);
+                this->has_pending = false;
+                this->writing = true;
+                lock.unlock();
+                this->StartWrite(&this->current);
+                return;
+            }
+            if (!this->ended && !cancelled) return;
+            this->finished = true;
+            Status status = cancelled && this->status.ok() ? Status(grpc::StatusCode::CANCELLED, "action cancelled") : this->status;
+            lock.unlock();
+            this->Finish(status);
+        }
+        std::shared_ptr<Job> job;
+        ActionUpdate current;
+        ActionUpdate pending;
+        bool has_pending = false;
+        bool writing = false;
+        bool ended = false;
+        bool finished = false;
+        Status status;
+    };
+    /*
+     * service calls on the gRPC callback API: the call is handed to its service's workers and
+     * answered from there, no gRPC thread waits for a callback and no node wide lock is taken.
+     */
+    class ServerClientServiceImpl final : public ServerClient::CallbackService {
         public:
         ServerClientServiceImpl(NodeHandler *nh) : nh_(nh) {}
-        Status Serving(ServerContext* context, const ServingRequest* request,
+        grpc::ServerUnaryReactor* Call(grpc::CallbackServerContext* context, const CallRequest* request,
+                        CallReply* reply) override {
+            std::shared_ptr<Communicator> server = this->nh_->service_server(request->service_id());
+            return this->run(context, server, [server, request, reply]() {
+                if (server->handle(request->payload(), *reply->mutable_payload())) return Status::OK;
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed request");
+            });
+        }
+        /* jobs take the next request of the batch until none is left: one job in order, otherwise as
+           many as the service runs at once, so a batch never floods the service's backlog */
+        grpc::ServerUnaryReactor* CallBatch(grpc::CallbackServerContext* context, const CallBatchRequest* request,
+                        CallBatchReply* reply) override {
+            grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+            std::shared_ptr<Communicator> server = this->nh_->service_server(request->service_id());
+            if (!server) {
+                reactor->Finish(Status(grpc::StatusCode::UNAVAILABLE, "no such service"));
+                return reactor;
+            }
+            int count = request->payloads_size();
+            /* every reply slot exists up front, so the jobs fill in distinct ones */
+            for (int i = 0; i < count; i++) reply->add_payloads();
+            struct Batch {
+                std::atomic<int> next{0};
+                std::atomic<size_t> running{0};
+                std::atomic<bool> malformed{false};
+                std::atomic<bool> expired{false};
+            };
+            std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+            std::chrono::system_clock::time_point deadline = context->deadline();
+            auto finish = [batch, reactor]() {
+                if (batch->expired) reactor->Finish(Status(grpc::StatusCode::DEADLINE_EXCEEDED, "deadline exceeded during the batch"));
+                else if (batch->malformed) reactor->Finish(Status(grpc::StatusCode::INVALID_ARGUMENT, "malformed request"));
+                else reactor->Finish(Status::OK);
+            };
+            size_t jobs = request->in_order() ? 1 : std::min<size_t>(server->concurrency(), count);
+            if (jobs == 0) {
+                finish();
+                return reactor;
+            }
+            batch->running = jobs;
+            for (size_t j = 0; j < jobs; j++) {
+                bool accepted = server->dispatch([server, request, reply, batch, count, finish, deadline]() {
+                    DeadlineScope scope(deadline);
+                    for (int i = batch->next++; i < count; i = batch->next++) {
+                        /* the rest of the batch would only be thrown away */
+                        if (std::chrono::system_clock::now() > deadline) {
+                            batch->expired = true;
+                            break;
+                        }
+                        if (!server->handle(request->payloads(i), *reply->mutable_payloads(i))) batch->malformed = true;
+                    }
+                    if (--batch->running == 0) finish();
+                });
+                if (accepted) continue;
+                if (j == 0) reactor->Finish(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "service is busy"));
+                /* fewer jobs then, the accepted ones work through the whole batch */
+                else if (batch->running.fetch_sub(jobs - j) == jobs - j) finish();
+                break;
+            }
+            return reactor;
+        }
+        grpc::ServerWriteReactor<ActionUpdate>* Act(grpc::CallbackServerContext* context, const ActionGoal* request) override {
+            return new ActionReactor(this->nh_->service_server(request->action_id()), request);
+        }
+        grpc::ServerWriteReactor<Invalidation>* WatchInvalidations(grpc::CallbackServerContext* context, const InvalidationRequest* request) override {
+            std::shared_ptr<Communicator> server = this->nh_->service_server(request->service_id());
+            return new InvalidationReactor(server ? server->cache_watchers() : nullptr, request->service_id());
+        }
+        /* the Any based call of older clients */
+        grpc::ServerUnaryReactor* Serving(grpc::CallbackServerContext* context, const ServingRequest* request,
                         ServingReply* reply) override {
-            std::lock_guard<std::mutex> lock(nh_->mutex_);
-            nh_->service_servers[request->service_name()]->request_handler(request->payload(), *reply);
-            return Status::OK;
+            std::shared_ptr<Communicator> server = this->nh_->service_server(request->service_name());
+            return this->run(context, server, [server, request, reply]() {
+                server->request_handler(request->payload(), *reply);
+                return Status::OK;
+            });
         }
         private:
+        grpc::ServerUnaryReactor* run(grpc::CallbackServerContext* context, const std::shared_ptr<Communicator> &server, std::function<Status()> call) {
+            grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+            if (!server) {
+                reactor->Finish(Status(grpc::StatusCode::UNAVAILABLE, "no such service"));
+                return reactor;
+            }
+            std::chrono::system_clock::time_point deadline = context->deadline();
+            bool accepted = server->dispatch([call, reactor, deadline]() {
+                /* the caller gave up while the call was queued, do not run it at all */
+                if (std::chrono::system_clock::now() > deadline) {
+                    reactor->Finish(Status(grpc::StatusCode::DEADLINE_EXCEEDED, "deadline exceeded before the call ran"));
+                    return;
+                }
+                DeadlineScope scope(deadline);
+                reactor->Finish(call());
+            });
+            if (!accepted) reactor->Finish(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "service is busy"));
+            return reactor;
+        }
         NodeHandler *nh_;
     };
     template<class T>
-    Subscriber<T>::Subscriber(std::string topic, float freq, void (*func)(T), NodeHandler *nh, int maxSize) :
-        topic_name(topic), rate(freq), cb_func(func), nh_(nh), maxSize(maxSize)
+    Subscriber<T>::Subscriber(std::string topic, float freq, void (*func)(T), NodeHandler *nh, int maxSize, Filter filter, FlowControl flow) :
+        nh_(nh), cb_func(func), rate(freq), filter(filter), flow(flow), maxSize(maxSize), topic_name(topic)
     {
-        /* Part I. start accepting and receiving from tcp port */
+        /* by default a publisher may have as many frames in flight as our queue holds */
+        if (this->flow.credits() == 0) this->flow.set_credits(std::max(maxSize, 1));
+        /* Part I. receive from the node's shared links under our own topic id */
         {
             std::lock_guard<std::mutex> lock(this->nh_->mutex_);
-            this->tcp_ip = this->nh_->local_ip;
+            this->tcp_ip = this->nh_->links->ip;
+            this->tcp_port = this->nh_->links->tcp_port;
+            this->uds_path = this->nh_->links->uds_path;
             this->rpc_port = this->nh_->rpc_port;
         }
-        bool ret = false;
-        tcp_acceptor = AcceptorSocket(this->tcp_ip, this->tcp_port, ret);
-        if (ret) {
-            std::thread acceptor_thread_ = std::thread([this, maxSize]() {
-                while (1) {
-                    bool ret;
-                    int sock;
-                    ret = this->tcp_acceptor.Accept(sock);
-                    std::cout << "Successful Create acceptor socket\n";
-                    if (ret) {
-                        std::shared_ptr<ServerSocket<T> > srv_sock = std::make_shared<ServerSocket<T> >(sock);
-                        std::thread receive_thread_ = std::thread([this, srv_sock, maxSize]() {
-                            std::cout << "Successful Connected as subscriber " << this->tcp_ip << ":" << this->tcp_port << "\n";
-                            while (1) {
-                                T msg;
-                                bool ret = srv_sock->SocketHandler(msg);
-                                if (ret) {
-                                    std::lock_guard<std::mutex> lock(this->queue_mutex_);
-                                    if (this->msgs_queue.size() >= maxSize) this->msgs_queue.pop();
-                                    this->msgs_queue.push(msg);
-                                }
-                                else {
-                                    break;
-                                }
-                            }
-                            srv_sock->disconnect();
-                        });
-                        receive_thread_.detach();
-                    }
-                }
-                this->tcp_acceptor.disconnect();
-            });
-            acceptor_thread_.detach();
-        }
-        /* Part II. sending request to master for registration */
-        SubscribeRequest request;
-        {
-            std::lock_guard<std::mutex> lock(this->mutex_);
-            request.set_topic_name(topic);
-            EndPoint* endpoint = request.mutable_endpoint();
-            endpoint->set_ip(this->tcp_ip); // same as rpc ip, this is the ip of this node
-            endpoint->set_port(this->rpc_port);
-        }
-        std::thread master_stream_thread_ = std::thread([this, request]() {
-            ClientContext context;
-            std::shared_ptr<grpc::ClientReader<SubscribeReply> > stream(
-                this->nh_->stub_->Subscribe(&context, request));
-            SubscribeReply response;
-            while (stream->Read(&response)) {
-                std::lock_guard<std::mutex> lock(this->mutex_);
-                SubscriberRequest subscriber_request_;
-                subscriber_request_.set_topic_name(this->topic_name);
-                subscriber_request_.set_rate(this->rate);
-                EndPoint* tcp_endpoint = subscriber_request_.mutable_tcp_endpoint();
-                tcp_endpoint->set_ip(this->tcp_ip);
-                tcp_endpoint->set_port(this->tcp_port);
-                SubscriberReply subscriber_reply_;
-                ClientContext subscriber_context_;
-                std::unique_ptr<Connection::Stub> stub = 
-                Connection::NewStub(
-                    grpc::CreateChannel(response.endpoint().ip()+":"+std::to_string(response.endpoint().port()), 
-                    grpc::InsecureChannelCredentials()));
-                std::cout << "Receiving streaming message as Subscriber\n";
-                Status status = stub->Subscriber(&subscriber_context_, subscriber_request_, &subscriber_reply_);
-            }
+        this->topic_id = this->nh_->links->add_sink([this](const char *data, uint32_t size, const std::shared_ptr<InLink> &link) {
+            this->deliver(data, size, link);
         });
-        master_stream_thread_.detach();
-        /* Part III. start the spin handler thread */
-        std::thread spin_thread_ = std::thread([this]() {
+        /* Part II. start the spin handler thread, the publishers are found once start() registered us */
+        this->spin_thread = std::thread([this]() {
             while (true) {
                 std::unique_lock<std::mutex> lock(spin_mutex_);
+                if (this->stopped) return;
                 spin_cv.wait(lock);
+                if (this->stopped) return;
+                Delivery delivery;
                 {
                     std::lock_guard<std::mutex> lock_(this->queue_mutex_);
-                    if (this->msgs_queue.size() > 0) {
-                        this->cb_func(this->msgs_queue.front());
-                        this->msgs_queue.pop();
-                    }
+                    if (this->msgs_queue.size() == 0) continue;
+                    delivery = std::move(this->msgs_queue.front());
+                    this->msgs_queue.pop();
                 }
+                /* run the callback without the queue lock so the link keeps receiving meanwhile */
+                this->cb_func(delivery.msg);
+                delivery.link->consumed(this->topic_id, this->flow.credits());
             }
             
         });
-        spin_thread_.detach();
     }
+    /* find the publishers, through the master or multicast discovery */
     template<class T>
-    Publisher<T>::Publisher(std::string topic, NodeHandler *nh, int maxSize) :
-        topic_name(topic), nh_(nh), maxSize(maxSize) {
-        PublishRequest request;
-        { 
-            std::lock_guard<std::mutex> lock(nh_->mutex_);
-            request.set_topic_name(topic);
-            core::EndPoint* endpoint = request.mutable_endpoint();
-            endpoint->set_ip(nh_->local_ip);
-            endpoint->set_port(nh_->rpc_port);
-        }
-        std::thread master_stream_thread_ = std::thread([this, request]() {
-            ClientContext context;
-            std::shared_ptr<grpc::ClientReader<PublishReply> > stream(
-                this->nh_->stub_->Publish(&context, request));
-            PublishReply response;
-            while (stream->Read(&response)) {
-                PublisherRequest publisher_request_;
-                publisher_request_.set_topic_name(this->topic_name);
-                PublisherReply publisher_reply_;
-                ClientContext publisher_context_;
-                std::unique_ptr<Connection::Stub> stub = 
-                Connection::NewStub(
-                    grpc::CreateChannel(response.endpoint().ip()+":"+std::to_string(response.endpoint().port()), 
-                    grpc::InsecureChannelCredentials()));
-                Status status = stub->Publisher(&publisher_context_, publisher_request_, &publisher_reply_);
-                
-                /* Path 1 for create publisher client*/
-                bool ret = false;
-                std::shared_ptr<ClientSocket> c_sock = std::make_shared<ClientSocket>(ret);
-                
-                if (ret) {
-                    ret = c_sock->Connect(publisher_reply_.tcp_endpoint().ip(), publisher_reply_.tcp_endpoint().port());
-                    float freq = publisher_reply_.rate();
-                    if (ret){
-                        std::cout << "Successful Connected from publisher to subscriber " << publisher_reply_.tcp_endpoint().ip() << ":" << publisher_reply_.tcp_endpoint().port() << "\n";
-                        std::thread publish_thread_ = std::thread([this, c_sock, freq]() {
-                            Rate rate(freq);
-                            while (1) {
-                                std::string msg;
-                                {
-                                    std::lock_guard<std::mutex> lock(this->queue_mutex_);
-                                    if (this->msg_queue.size() > 0)  {
-                                        msg = this->msg_queue.front();
-                                        this->msg_queue.pop();
-                                        if (!c_sock->Send(msg)) break;
-                                    }
-                                }
-                                // c_sock->Send(msg);
-                                rate.sleep();
-                            }
-                            c_sock->disconnect();
-                        });
-                        publish_thread_.detach();
-                    }
-                }
-            }
+    void Subscriber<T>::start() {
+        this->nh_->registrar->subscribe(this->topic_name, [this](const EndPoint &publisher) { this->connect(publisher); });
+    }
+    /* Path 2: ask the publisher's node to open a link to us */
+    template<class T>
+    void Subscriber<T>::connect(const EndPoint &publisher) {
+        SubscriberRequest subscriber_request_;
+        this->call(subscriber_request_);
+        SubscriberReply subscriber_reply_;
+        ClientContext subscriber_context_;
+        std::unique_ptr<Connection::Stub> stub = Connection::NewStub(this->nh_->channel(publisher));
+        std::cout << "Receiving streaming message as Subscriber\n";
+        Status status = stub->Subscriber(&subscriber_context_, subscriber_request_, &subscriber_reply_);
+        if (status.error_code() == grpc::StatusCode::INVALID_ARGUMENT) this->refuse(status.error_message());
+        if (status.ok()) this->matches.add(peer_key(publisher));
+    }
+    template<class T>
+    void Subscriber<T>::call(SubscriberRequest &request) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        request.set_topic_name(this->topic_name);
+        request.set_rate(this->rate);
+        request.set_topic_id(this->topic_id);
+        request.set_host_id(this->nh_->host_id);
+        request.set_uds_path(this->uds_path);
+        EndPoint* tcp_endpoint = request.mutable_tcp_endpoint();
+        tcp_endpoint->set_ip(this->tcp_ip);
+        tcp_endpoint->set_port(this->tcp_port);
+        *request.mutable_filters() = this->filter.predicates;
+        *request.mutable_flow() = this->flow;
+        request.mutable_endpoint()->set_ip(this->nh_->local_ip);
+        request.mutable_endpoint()->set_port(this->rpc_port);
+    }
+    RawSubscriber::RawSubscriber(std::string topic, RawCallback func, NodeHandler *nh, float freq, Filter filter, FlowControl flow) :
+        nh_(nh), cb_func(func), type_name_(std::make_shared<const std::string>()),
+        rate(freq), filter(filter), flow(flow), topic_name(topic)
+    {
+        /* nothing is queued on our side, the window only covers frames in flight */
+        if (this->flow.credits() == 0) this->flow.set_credits(64);
+        /* Part I. receive from the node's shared links under our own topic id */
+        {
+            std::lock_guard<std::mutex> lock(this->nh_->mutex_);
+            this->tcp_ip = this->nh_->links->ip;
+            this->tcp_port = this->nh_->links->tcp_port;
+            this->uds_path = this->nh_->links->uds_path;
+            this->rpc_port = this->nh_->rpc_port;
+        }
+        this->topic_id = this->nh_->links->add_sink([this](const char *data, uint32_t size, const std::shared_ptr<InLink> &link) {
+            this->deliver(data, size, link);
         });
-        master_stream_thread_.detach();
     }
-    template<class RequestT, class ReplyT>
-    ServiceServer<RequestT, ReplyT>::ServiceServer(std::string service, void(*func) (RequestT, ReplyT&), NodeHandler* nh) :
-        service_name(service), cb_func(func), nh_(nh) {
-        ClientContext context;
-        ServiceServerRequest send_request;
-        ServiceServerReply send_reply;
-        send_request.set_service_name(service);
-        core::EndPoint* endpoint = send_request.mutable_endpoint();
-        {     
-            std::lock_guard<std::mutex> lock(nh_->mutex_);
-            endpoint->set_ip(nh_->local_ip);
-            endpoint->set_port(nh_->rpc_port);
+    void RawSubscriber::start() {
+        this->nh_->registrar->subscribe(this->topic_name, [this](const EndPoint &publisher) { this->connect(publisher); });
+    }
+    void RawSubscriber::connect(const EndPoint &publisher) {
+        SubscriberRequest subscriber_request_;
+        this->call(subscriber_request_);
+        SubscriberReply subscriber_reply_;
+        ClientContext subscriber_context_;
+        std::unique_ptr<Connection::Stub> stub = Connection::NewStub(this->nh_->channel(publisher));
+        std::cout << "Receiving streaming message as Subscriber\n";
+        Status status = stub->Subscriber(&subscriber_context_, subscriber_request_, &subscriber_reply_);
+        if (status.error_code() == grpc::StatusCode::INVALID_ARGUMENT) this->refuse(status.error_message());
+        if (!status.ok()) return;
+        this->set_type_name(subscriber_reply_.type_name());
+        this->matches.add(peer_key(publisher));
+    }
+    void RawSubscriber::call(SubscriberRequest &request) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        request.set_topic_name(this->topic_name);
+        request.set_rate(this->rate);
+        request.set_topic_id(this->topic_id);
+        request.set_host_id(this->nh_->host_id);
+        request.set_uds_path(this->uds_path);
+        EndPoint* tcp_endpoint = request.mutable_tcp_endpoint();
+        tcp_endpoint->set_ip(this->tcp_ip);
+        tcp_endpoint->set_port(this->tcp_port);
+        *request.mutable_filters() = this->filter.predicates;
+        *request.mutable_flow() = this->flow;
+        request.mutable_endpoint()->set_ip(this->nh_->local_ip);
+        request.mutable_endpoint()->set_port(this->rpc_port);
+    }
+    template<class T>
+    Publisher<T>::Publisher(std::string topic, NodeHandler *nh, int maxSize) :
+        nh_(nh), topic_name(topic), maxSize(maxSize) {
+    }
+    template<class T>
+    void Publisher<T>::start() {
+        this->nh_->registrar->advertise(this->topic_name, this->type_name(), [this](const EndPoint &subscriber) { this->connect(subscriber); });
+    }
+    /* Path 1: ask a newly registered subscriber's node where to open our link */
+    template<class T>
+    void Publisher<T>::connect(const EndPoint &subscriber) {
+        PublisherRequest publisher_request_;
+        publisher_request_.set_topic_name(this->topic_name);
+        publisher_request_.set_host_id(this->nh_->host_id);
+        publisher_request_.set_type_name(this->type_name());
+        publisher_request_.mutable_endpoint()->set_ip(this->nh_->local_ip);
+        publisher_request_.mutable_endpoint()->set_port(this->nh_->rpc_port);
+        PublisherReply publisher_reply_;
+        ClientContext publisher_context_;
+        std::unique_ptr<Connection::Stub> stub = Connection::NewStub(this->nh_->channel(subscriber));
+        Status status = stub->Publisher(&publisher_context_, publisher_request_, &publisher_reply_);
+        if (!status.ok()) return;
+        SubscriberRequest subscriber_request_;
+        subscriber_request_.set_topic_name(this->topic_name);
+        subscriber_request_.set_rate(publisher_reply_.rate());
+        subscriber_request_.set_topic_id(publisher_reply_.topic_id());
+        subscriber_request_.set_uds_path(publisher_reply_.uds_path());
+        *subscriber_request_.mutable_tcp_endpoint() = publisher_reply_.tcp_endpoint();
+        *subscriber_request_.mutable_filters() = publisher_reply_.filters();
+        *subscriber_request_.mutable_flow() = publisher_reply_.flow();
+        *subscriber_request_.mutable_endpoint() = subscriber;
+        this->connect_subscriber(subscriber_request_);
+    }
+    template<class T>
+    void Publisher<T>::connect_subscriber(const SubscriberRequest &request) {
+        SubscriberChannel subscriber_channel;
+        subscriber_channel.filter = std::make_shared<CompiledFilter>(T::descriptor(), request.filters());
+        if (!subscriber_channel.filter->error().empty()) {
+            std::cerr << "Not linking subscriber " << peer_key(request.tcp_endpoint()) << ", " << subscriber_channel.filter->error() << "\n";
+            return;
+        }
+        std::shared_ptr<OutLink> link = this->nh_->links->link_to(request.tcp_endpoint().ip(), request.tcp_endpoint().port(), request.uds_path());
+        if (!link) return;
+        subscriber_channel.channel = link->add_channel(request.topic_id(), request.rate(), this->maxSize, request.flow());
+        std::lock_guard<std::mutex> lock(this->queue_mutex_);
+        for (auto &channel : this->channels) {
+            if (channel.channel == subscriber_channel.channel) return;
+        }
+        subscriber_channel.key = peer_key(request.tcp_endpoint()) + "/" + std::to_string(request.topic_id());
+        subscriber_channel.node = peer_key(request.endpoint());
+        this->channels.push_back(subscriber_channel);
+        this->matches.add(subscriber_channel.key);
+        while (!this->msg_queue.empty()) {
+            this->send(this->msg_queue.front());
+            this->msg_queue.pop();
+        }
+        std::cout << "Successful Connected from publisher to subscriber " << request.tcp_endpoint().ip() << ":" << request.tcp_endpoint().port()
+                  << " topic id " << request.topic_id() << "\n";
+    }
+    RawPublisher::RawPublisher(std::string topic, std::string type_name, const google::protobuf::Descriptor *descriptor, NodeHandler *nh, int maxSize) :
+        nh_(nh), descriptor(descriptor), prototype(nullptr), type_name_(type_name), topic_name(topic), maxSize(maxSize) {
+        if (this->descriptor) {
+            this->factory.reset(new google::protobuf::DynamicMessageFactory());
+            this->prototype = this->factory->GetPrototype(this->descriptor);
         }
-        Status status = this->nh_->stub_->ServiceServers(&context, send_request, &send_reply);
+    }
+    void RawPublisher::start() {
+        this->nh_->registrar->advertise(this->topic_name, this->type_name(), [this](const EndPoint &subscriber) { this->connect(subscriber); });
+    }
+    /* Path 1: ask a newly registered subscriber's node where to open our link */
+    void RawPublisher::connect(const EndPoint &subscriber) {
+        PublisherRequest publisher_request_;
+        publisher_request_.set_topic_name(this->topic_name);
+        publisher_request_.set_host_id(this->nh_->host_id);
+        publisher_request_.set_type_name(this->type_name());
+        publisher_request_.mutable_endpoint()->set_ip(this->nh_->local_ip);
+        publisher_request_.mutable_endpoint()->set_port(this->nh_->rpc_port);
+        PublisherReply publisher_reply_;
+        ClientContext publisher_context_;
+        std::unique_ptr<Connection::Stub> stub = Connection::NewStub(this->nh_->channel(subscriber));
+        Status status = stub->Publisher(&publisher_context_, publisher_request_, &publisher_reply_);
+        if (!status.ok()) return;
+        SubscriberRequest subscriber_request_;
+        subscriber_request_.set_topic_name(this->topic_name);
+        subscriber_request_.set_rate(publisher_reply_.rate());
+        subscriber_request_.set_topic_id(publisher_reply_.topic_id());
+        subscriber_request_.set_uds_path(publisher_reply_.uds_path());
+        *subscriber_request_.mutable_tcp_endpoint() = publisher_reply_.tcp_endpoint();
+        *subscriber_request_.mutable_filters() = publisher_reply_.filters();
+        *subscriber_request_.mutable_flow() = publisher_reply_.flow();
+        *subscriber_request_.mutable_endpoint() = subscriber;
+        this->connect_subscriber(subscriber_request_);
+    }
+    void RawPublisher::connect_subscriber(const SubscriberRequest &request) {
+        SubscriberChannel subscriber_channel;
+        if (this->descriptor) subscriber_channel.filter = std::make_shared<CompiledFilter>(this->descriptor, request.filters());
+        else if (request.filters_size() > 0) std::cerr << "No descriptor for " << this->type_name_ << ", ignoring the subscriber's filter\n";
+        if (subscriber_channel.filter && !subscriber_channel.filter->error().empty()) {
+            std::cerr << "Not linking subscriber " << peer_key(request.tcp_endpoint()) << ", " << subscriber_channel.filter->error() << "\n";
+            return;
+        }
+        std::shared_ptr<OutLink> link = this->nh_->links->link_to(request.tcp_endpoint().ip(), request.tcp_endpoint().port(), request.uds_path());
+        if (!link) return;
+        subscriber_channel.channel = link->add_channel(request.topic_id(), request.rate(), this->maxSize, request.flow());
+        std::lock_guard<std::mutex> lock(this->queue_mutex_);
+        for (auto &channel : this->channels) {
+            if (channel.channel == subscriber_channel.channel) return;
+        }
+        subscriber_channel.key = peer_key(request.tcp_endpoint()) + "/" + std::to_string(request.topic_id());
+        subscriber_channel.node = peer_key(request.endpoint());
+        this->channels.push_back(subscriber_channel);
+        this->matches.add(subscriber_channel.key);
+        while (!this->msg_queue.empty()) {
+            this->send(this->msg_queue.front());
+            this->msg_queue.pop();
+        }
+        std::cout << "Successful Connected from publisher to subscriber " << request.tcp_endpoint().ip() << ":" << request.tcp_endpoint().port()
+                  << " topic id " << request.topic_id() << "\n";
     }
     template<class RequestT, class ReplyT>
-    ServiceClient<RequestT, ReplyT>::ServiceClient(std::string service, NodeHandler* nh) : 
-    service_name(service), nh_(nh), connected(false), mutex_() {
-        ServiceClientRequest request;
-        request.set_service_name(service);
-        std::thread master_stream_thread_ = std::thread([this, request]() {
-            ClientContext client_context_;
-            std::shared_ptr<grpc::ClientReader<ServiceClientReply> > stream(
-                this->nh_->stub_->ServiceClients(&client_context_, request));
-            ServiceClientReply response;
-            while (stream->Read(&response)) {
-                std::lock_guard<std::mutex> lock(this->mutex_);
-                std::cout << response.endpoint().ip()+":"+std::to_string(response.endpoint().port()) << "\n";
-                this->stub.reset(new ServerClient::Stub(
-                    grpc::CreateChannel(response.endpoint().ip()+":"+std::to_string(response.endpoint().port()), 
-                    grpc::InsecureChannelCredentials())));
-                this->connected = true;
+    ServiceServer<RequestT, ReplyT>::ServiceServer(std::string service, void(*func) (RequestT, ReplyT&), NodeHandler* nh, ServiceOptions options) :
+        workers(options.concurrency, options.max_queue), cb_func(func), service_name(service), nh_(nh) {
+    }
+    template<class RequestT, class ReplyT>
+    ServiceClient<RequestT, ReplyT>::ServiceClient(std::string service, NodeHandler* nh, Balance balance) : 
+    service_name(service), service_id(serviceId(service)), nh_(nh), servers(balance) {
+        this->nh_->registrar->call(service, [this](const EndPoint &server) { this->connect(server); });
+    }
+    template<class RequestT, class ReplyT>
+    void ServiceClient<RequestT, ReplyT>::connect(const EndPoint &server) {
+        if (server.ip() == this->nh_->local_ip && (int)server.port() == this->nh_->rpc_port) {
+            std::shared_ptr<ServiceServer<RequestT, ReplyT> > local =
+                std::dynamic_pointer_cast<ServiceServer<RequestT, ReplyT> >(this->nh_->service_server(this->service_id));
+            if (local) {
+                std::atomic_store(&this->local_, local);
+                std::cout << "Service " << this->service_name << " served in this node\n";
+                this->matches.add(peer_key(server));
+                return;
             }
+        }
+        std::string target = this->nh_->rpc_target(server);
+        /* warmed up now, the first call finds the connection open */
+        if (!this->servers.add(peer_key(server), this->nh_->channel(server, true))) return;
+        {
+            std::lock_guard<std::mutex> lock(this->cache_mutex_);
+            this->endpoints[peer_key(server)] = server;
+        }
+        if (this->cache_enabled) this->watch_invalidations(server);
+        std::cout << "Service " << this->service_name << " server " << peer_key(server) << (target.empty() ? "" : " (unix socket)") << "\n";
+        this->matches.add(peer_key(server));
+    }
+    template<class RequestT, class ReplyT>
+    void ServiceClient<RequestT, ReplyT>::watch_invalidations(const EndPoint &server) {
+        this->nh_->streams.spawn([this, server]() {
+            std::string key = peer_key(server);
+            do {
+                {
+                    std::lock_guard<std::mutex> lock(this->cache_mutex_);
+                    if (!this->endpoints.count(key)) return;
+                }
+                std::unique_ptr<ServerClient::Stub> stub = ServerClient::NewStub(this->nh_->channel(server));
+                ClientContext context;
+                if (!this->nh_->streams.open(&context)) return;
+                InvalidationRequest request;
+                request.set_service_id(this->service_id);
+                std::unique_ptr<grpc::ClientReader<Invalidation> > reader(stub->WatchInvalidations(&context, request));
+                Invalidation invalidation;
+                while (reader->Read(&invalidation)) this->invalidate();
+                reader->Finish();
+                this->nh_->streams.close(&context);
+                this->invalidate();
+            } while (this->nh_->streams.wait(std::chrono::seconds(1)));
         });
-        master_stream_thread_.detach();
     }
-    NodeHandler::NodeHandler() :
-    stub_(Registration::NewStub(grpc::CreateChannel(std::string(getenv("CORE_MASTER_ADDR")), grpc::InsecureChannelCredentials()))) {
+    template<class GoalT, class FeedbackT, class ResultT>
+    ActionServer<GoalT, FeedbackT, ResultT>::ActionServer(std::string action, void(*func) (GoalT, ActionHandle<FeedbackT>&, ResultT&), NodeHandler* nh, ServiceOptions options) :
+        workers(options.concurrency, options.max_queue), cb_func(func), action_name(action), nh_(nh) {
+    }
+    template<class GoalT, class FeedbackT, class ResultT>
+    ActionClient<GoalT, FeedbackT, ResultT>::ActionClient(std::string action, NodeHandler* nh, Balance balance) :
+    action_name(action), action_id(serviceId(action)), nh_(nh), servers(balance) {
+        this->nh_->registrar->call(action, [this](const EndPoint &server) { this->connect(server); });
+    }
+    /* an action in this very node still goes through gRPC, over its unix socket */
+    template<class GoalT, class FeedbackT, class ResultT>
+    void ActionClient<GoalT, FeedbackT, ResultT>::connect(const EndPoint &server) {
+        std::string target = this->nh_->rpc_target(server);
+        if (!this->servers.add(peer_key(server), this->nh_->channel(server, true))) return;
+        std::cout << "Action " << this->action_name << " server " << peer_key(server) << (target.empty() ? "" : " (unix socket)") << "\n";
+        this->matches.add(peer_key(server));
+    }
+    /* identifies the machine (and boot) a node runs on, peers with equal ids may use unix sockets */
+    std::string hostIdentity() {
+        char hostname[256] = {0};
+        gethostname(hostname, sizeof(hostname) - 1);
+        std::string boot_id;
+        std::ifstream boot_file("/proc/sys/kernel/random/boot_id");
+        std::getline(boot_file, boot_id);
+        return std::string(hostname) + "/" + boot_id;
+    }
+    NodeHandler::NodeHandler() {
         signal(SIGPIPE, SIG_IGN);
         local_ip = std::string(getenv("CORE_LOCAL_IP")); // ip
-        master_addr = std::string(getenv("CORE_MASTER_ADDR")); // 'ip:port'
+        master_addr = getenv("CORE_MASTER_ADDR") ? getenv("CORE_MASTER_ADDR") : ""; // 'ip:port', not needed with discovery
+        const char *discovery_mode = getenv("CORE_DISCOVERY");
+        bool multicast = discovery_mode && std::string(discovery_mode) == "multicast";
+        /* checked before anything is started, the destructor does not run for a throwing constructor */
+        if (master_addr.empty() && !multicast)
+            throw std::runtime_error("Neither CORE_MASTER_ADDR nor CORE_DISCOVERY=multicast is set");
+        if (!master_addr.empty()) stub_ = Registration::NewStub(grpc::CreateChannel(master_addr, grpc::InsecureChannelCredentials()));
+        host_id = hostIdentity();
         service = new ConnectionServiceImpl(this);
+        service_servers = std::make_shared<const ServiceMap>();
         service_serve = new ServerClientServiceImpl(this);
         grpc::EnableDefaultHealthCheckService(true);
         grpc::reflection::InitProtoReflectionServerBuilderPlugin();
         ServerBuilder builder;
         builder.AddListeningPort(local_ip + ":" + "0", grpc::InsecureServerCredentials(), &rpc_port);
+        static std::atomic<int> node_count(0);
+        rpc_uds = "grpccore." + std::to_string(getpid()) + "." + std::to_string(node_count++);
+        builder.AddListeningPort("unix-abstract:" + rpc_uds, grpc::InsecureServerCredentials());
         builder.RegisterService(service);
         builder.RegisterService(service_serve);
         server = std::unique_ptr<Server>(builder.BuildAndStart());
+        links = std::unique_ptr<LinkManager>(new LinkManager(local_ip));
+        EndPoint self;
+        self.set_ip(local_ip);
+        self.set_port(rpc_port);
+        self.set_host_id(host_id);
+        self.set_uds(rpc_uds);
+        if (multicast) {
+            const char *group = getenv("CORE_DISCOVERY_GROUP");
+            bool ret = false;
+            registrar.reset(new Discovery(self, group ? group : "239.255.0.1:10011", [this](const EndPoint &endpoint) { this->evicted(endpoint); }, ret));
+            if (!ret) {
+                registrar.reset();
+                std::cerr << "Multicast discovery unavailable, registering at the master\n";
+            }
+        }
+        if (!registrar) {
+            if (!stub_) {
+                this->server->Shutdown(std::chrono::system_clock::now());
+                this->server.reset();
+                this->links.reset();
+                delete this->service;
+                delete this->service_serve;
+                throw std::runtime_error("Multicast discovery is unavailable and CORE_MASTER_ADDR is not set");
+            }
+            registrar.reset(new MasterRegistrar(stub_.get(), self));
+            streams.spawn([this]() { this->keep_lease(); });
+        }
+    }
+    /* every thread of the node is gone before the communicators they call into */
+    NodeHandler::~NodeHandler() {
+        this->streams.stop();
+        this->registrar.reset();
+        /* pending calls and streams are cancelled right away, not waited for */
+        this->server->Shutdown(std::chrono::system_clock::now());
+        this->server.reset();
+        delete this->service;
+        delete this->service_serve;
+        this->links.reset();
+    }
+    /* holds this node's lease at the master, reopening the stream whenever it ends */
+    void NodeHandler::keep_lease() {
+        LeaseHeartbeat heartbeat;
+        heartbeat.mutable_endpoint()->set_ip(this->local_ip);
+        heartbeat.mutable_endpoint()->set_port(this->rpc_port);
+        heartbeat.set_ttl_ms(LEASE_TTL_MS);
+        do {
+            ClientContext context;
+            if (!this->streams.open(&context)) return;
+            std::shared_ptr<grpc::ClientReaderWriter<LeaseHeartbeat, LeaseEvent> > stream(this->stub_->Lease(&context));
+            std::atomic<bool> alive(true);
+            std::thread heartbeat_thread([&]() {
+                while (alive && stream->Write(heartbeat) && this->streams.wait(std::chrono::milliseconds(LEASE_TTL_MS / 4))) {}
+            });
+            LeaseEvent event;
+            while (stream->Read(&event)) this->evicted(event.evicted());
+            alive = false;
+            heartbeat_thread.join();
+            stream->WritesDone();
+            stream->Finish();
+            this->streams.close(&context);
+        } while (this->streams.wait(std::chrono::seconds(1)));
+    }
+    void NodeHandler::evicted(const EndPoint &endpoint) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (auto &pair : this->subscribers) pair.second->evicted(endpoint);
+        for (auto &pair : this->publishers) pair.second->evicted(endpoint);
+        for (auto &pair : this->service_clients) pair.second->evicted(endpoint);
     }
 }
 
@@ -0,0 +1,131 @@
+#ifndef REGISTRAR_H
+#define REGISTRAR_H
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "registration.grpc.pb.h"
+#include "StreamThreads.h"
+
+/*
+ * How a node announces its publishers, subscribers, service servers and clients and learns about
+ * their peers: MasterRegistrar (grpccore) or Discovery (multicast, no master).
+ */
+namespace core {
+    class Registrar {
+        public:
+        using Found = std::function<void(const EndPoint &endpoint)>;
+        virtual ~Registrar() {}
+        /* found runs on its own thread for every peer, known now or found later:
+           subscribers for a publisher (only where the publisher has to dial), publishers for a subscriber,
+           servers for a service client */
+        virtual void advertise(const std::string &topic, const std::string &type_name, Found found) = 0;
+        virtual void subscribe(const std::string &topic, Found found) = 0;
+        virtual void serve(const std::string &service) = 0;
+        virtual void call(const std::string &service, Found found) = 0;
+        protected:
+        /* connecting is a blocking rpc, keep it off the registration threads */
+        static void dispatch(const Found &found, const EndPoint &endpoint) {
+            std::thread(found, endpoint).detach();
+        }
+    };
+    /*
+     * all registrations of the node share one Register stream to the master. Registrations made in
+     * a row go out together in one batch, and everything is registered again on a new stream if the
+     * stream ends (master restarted, or this node was evicted while it hung).
+     */
+    class MasterRegistrar : public Registrar {
+        public:
+        MasterRegistrar(Registration::Stub *stub, const EndPoint &self) : stub_(stub), self(self) {
+            this->streams.spawn([this]() { this->keep_registered(); });
+        }
+        ~MasterRegistrar() {
+            this->streams.stop();
+        }
+        void advertise(const std::string &topic, const std::string &type_name, Found found) override {
+            this->add(RegisterEntry::PUBLISHER, topic, type_name, found);
+        }
+        void subscribe(const std::string &topic, Found found) override {
+            this->add(RegisterEntry::SUBSCRIBER, topic, "", found);
+        }
+        void serve(const std::string &service) override {
+            this->add(RegisterEntry::SERVICE_SERVER, service, "", nullptr);
+        }
+        void call(const std::string &service, Found found) override {
+            this->add(RegisterEntry::SERVICE_CLIENT, service, "", found);
+        }
+        private:
+        using Key = std::pair<int, std::string>;
+        void add(RegisterEntry::Kind kind, const std::string &name, const std::string &type_name, Found found) {
+            RegisterEntry entry;
+            entry.set_kind(kind);
+            entry.set_name(name);
+            entry.set_type_name(type_name);
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->entries.push_back(entry);
+                this->pending.push_back(entry);
+                if (found) this->founds.insert(std::make_pair(Key(kind, name), found));
+            }
+            this->cv_.notify_one();
+        }
+        void keep_registered() {
+            do {
+                grpc::ClientContext context;
+                if (!this->streams.open(&context)) return;
+                std::shared_ptr<grpc::ClientReaderWriter<RegisterBatch, RegisterEvent> > stream(this->stub_->Register(&context));
+                std::atomic<bool> alive(true);
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    this->pending = this->entries;
+                }
+                std::thread writer([&]() {
+                    while (alive) {
+                        RegisterBatch batch;
+                        {
+                            std::unique_lock<std::mutex> lock(this->mutex_);
+                            this->cv_.wait_for(lock, std::chrono::milliseconds(200), [&]() { return !this->pending.empty() || !alive; });
+                            if (this->pending.empty()) continue;
+                            for (const RegisterEntry &entry : this->pending) *batch.add_entries() = entry;
+                            this->pending.clear();
+                        }
+                        *batch.mutable_endpoint() = this->self;
+                        if (!stream->Write(batch)) break;
+                    }
+                });
+                RegisterEvent event;
+                while (stream->Read(&event)) {
+                    std::lock_guard<std::mutex> lock(this->mutex_);
+                    auto range = this->founds.equal_range(Key(event.kind(), event.name()));
+                    for (auto iter = range.first; iter != range.second; iter++) dispatch(iter->second, event.endpoint());
+                }
+                alive = false;
+                this->cv_.notify_all();
+                writer.join();
+                stream->WritesDone();
+                stream->Finish();
+                this->streams.close(&context);
+            } while (this->streams.wait(std::chrono::seconds(1)));
+        }
+        Registration::Stub *stub_;
+        EndPoint self;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::vector<RegisterEntry> entries;
+        std::vector<RegisterEntry> pending;
+        std::multimap<Key, Found> founds;
+        StreamThreads streams;
+    };
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef STREAMTHREADS_H
+#define STREAMTHREADS_H
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+/*
+ * The threads that keep a long lived client stream open (lease, registration, invalidation watches)
+ * and reopen it when it ends. Their owner calls stop() before it goes away: the open streams are
+ * cancelled, the waits before a retry return at once and the threads are joined.
+ */
+namespace core {
+    class StreamThreads {
+        public:
+        ~StreamThreads() {
+            this->stop();
+        }
+        /* runs body on a thread of its own, nothing once stopped */
+        void spawn(std::function<void()> body) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->stopped_) return;
+            this->threads.emplace_back(std::move(body));
+        }
+        /* a stream is about to be opened with context, false once stopped. close() it after Finish() */
+        bool open(grpc::ClientContext *context) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->stopped_) return false;
+            this->contexts.insert(context);
+            return true;
+        }
+        void close(grpc::ClientContext *context) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->contexts.erase(context);
+        }
+        /* sleeps before a retry, false (right away) once stopped */
+        bool wait(std::chrono::milliseconds delay) {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            return !this->cv_.wait_for(lock, delay, [this]() { return this->stopped_; });
+        }
+        bool stopped() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->stopped_;
+        }
+        void stop() {
+            std::vector<std::thread> running;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->stopped_ = true;
+                for (grpc::ClientContext *context : this->contexts) context->TryCancel();
+                running.swap(this->threads);
+            }
+            this->cv_.notify_all();
+            for (std::thread &thread : running) {
+                if (thread.get_id() == std::this_thread::get_id()) thread.detach();
+                else thread.join();
+            }
+        }
+        private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stopped_ = false;
+        std::set<grpc::ClientContext *> contexts;
+        std::vector<std::thread> threads;
+    };
+}
+
+#endif
@@ -10,32 +10,97 @@
 #include <resolv.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
+#include <algorithm>
 #include <iostream>
 
-/* specific for protobuf sending */
+#include <vector>
+
+/* specific for protobuf sending, every frame on a link is [payload size : le32][topic id : le32][payload] */
 namespace core{
-    template<class T>
+    const size_t FRAME_HEADER_SIZE = 8;
+    /* larger sizes are taken for a corrupt stream (or not a link at all) and end the link */
+    const uint32_t MAX_FRAME_SIZE = 64 << 20;
+    /* read one frame, payload buffer is reused between calls to avoid reallocating */
+    inline bool ReadFrame(int sock, uint32_t &topic_id, std::vector<char> &payload) {
+        char buffer[FRAME_HEADER_SIZE];
+        ssize_t bytecount=0;
+        if((bytecount = recv(sock, buffer, FRAME_HEADER_SIZE, MSG_WAITALL))== -1){
+            std::cerr << "Error receiving data\n";
+            return false;
+        }
+        else if ((size_t)bytecount < FRAME_HEADER_SIZE) {
+            std::cerr << "Error receiving empty data\n";
+            return false;
+        }
+        google::protobuf::uint32 siz;
+        google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray((const uint8_t*)buffer, &siz);
+        google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray((const uint8_t*)buffer + 4, &topic_id);
+        if (siz > MAX_FRAME_SIZE) {
+            std::cerr << "Error receiving frame of " << siz << " bytes, over the limit\n";
+            return false;
+        }
+        payload.resize(siz);
+        if (siz == 0) return true;
+        if((bytecount = recv(sock, (void *)payload.data(), siz, MSG_WAITALL)) != (ssize_t)siz){
+            std::cerr << "Error receiving data\n";
+            return false;
+        }
+        return true;
+    }
+    inline bool SendFrame(int sock, uint32_t topic_id, const std::string &payload) {
+        uint8_t header[FRAME_HEADER_SIZE];
+        google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(payload.size(), header);
+        google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(topic_id, header + 4);
+        iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = FRAME_HEADER_SIZE;
+        iov[1].iov_base = (void *)payload.data();
+        iov[1].iov_len = payload.size();
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        size_t remain = FRAME_HEADER_SIZE + payload.size();
+        while (remain > 0) {
+            ssize_t bytecount = sendmsg(sock, &msg, MSG_NOSIGNAL);
+            if (bytecount == -1) {
+                if (errno == EINTR) continue;
+                std::cerr << "Error Publishing.\n";
+                return false;
+            }
+            remain -= bytecount;
+            /* partial write, advance the iovecs */
+            while (bytecount > 0 && msg.msg_iovlen > 0) {
+                size_t step = std::min((size_t)bytecount, msg.msg_iov[0].iov_len);
+                msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + step;
+                msg.msg_iov[0].iov_len -= step;
+                bytecount -= step;
+                if (msg.msg_iov[0].iov_len == 0) {
+                    msg.msg_iov++;
+                    msg.msg_iovlen--;
+                }
+            }
+        }
+        return true;
+    }
     class ServerSocket {
         public:
         ServerSocket() {}
         ServerSocket(int sock) : socket_(sock) {}
-        bool SocketHandler(T &msg) {
-            char buffer[4];
-            int bytecount=0;
-            memset(buffer, '\0', 4);
-            if((bytecount = recv(this->socket_, buffer, 4, MSG_PEEK))== -1){
-                std::cerr << "Error receiving data\n";
-                return false;
-            }
-            else if (bytecount == 0) {
-                std::cerr << "Error receiving empty data\n";
-                return false;
-            }
-            // std::cout << "receving recv\n";
-            return readBody(msg, readHdr(buffer));
+        /* read one frame, payload buffer is reused between calls to avoid reallocating */
+        bool ReadFrame(uint32_t &topic_id, std::vector<char> &payload) {
+            return core::ReadFrame(this->socket_, topic_id, payload);
+        }
+        bool SendFrame(uint32_t topic_id, const std::string &payload) {
+            return core::SendFrame(this->socket_, topic_id, payload);
         }
         void disconnect() {
             int result = close(this->socket_);
@@ -45,46 +110,29 @@ namespace core{
                 std::cerr << "Error closing socket\n";
             }
         }
+        /* a blocked ReadFrame returns false, the socket stays open until disconnect() */
+        void Shutdown() {
+            shutdown(this->socket_, SHUT_RDWR);
+        }
         private:
         int socket_;
-        google::protobuf::uint32 readHdr(char* buf) {
-            google::protobuf::uint32 size;
-            google::protobuf::io::ArrayInputStream ais(buf,4);
-            google::protobuf::io::CodedInputStream coded_input(&ais);
-            coded_input.ReadLittleEndian32(&size);
-            return size;
-        }
-        bool readBody(T &payload, google::protobuf::uint32 siz) {
-            int bytecount;
-            // char buffer [siz+4];
-            std::vector<char> buffer(siz+4);
-            if((bytecount = recv(this->socket_, (void *)buffer.data(), 4+siz, MSG_WAITALL))== -1){
-                std::cerr << "Error receiving data\n";
-                return false;
-            }
-            google::protobuf::io::ArrayInputStream ais(buffer.data(),siz+4);
-            google::protobuf::io::CodedInputStream coded_input(&ais);
-            coded_input.ReadLittleEndian32(&siz);
-            google::protobuf::io::CodedInputStream::Limit msgLimit = coded_input.PushLimit(siz);
-            payload.ParseFromCodedStream(&coded_input);
-            coded_input.PopLimit(msgLimit);
-            return true;
-        }
     };
     class ClientSocket {
         public:
         ClientSocket() {}
-        ClientSocket(bool &ret) {
-            this->socket_ = socket(AF_INET, SOCK_STREAM, 0);
+        ClientSocket(bool &ret, int domain = AF_INET) {
+            this->socket_ = socket(domain, SOCK_STREAM, 0);
             if(this->socket_ == -1){
                 std::cerr << "Error create TCP client.\n";
             }
-            int* sockopt_ptr = (int*)malloc(sizeof(int));
-            *sockopt_ptr = 1;
-            if( (setsockopt(this->socket_, SOL_SOCKET, SO_REUSEADDR, (char*)sockopt_ptr, sizeof(int)) == -1 )||
-            (setsockopt(this->socket_, SOL_SOCKET, SO_KEEPALIVE, (char*)sockopt_ptr, sizeof(int)) == -1 ) ){
-                std::cerr << "Error setting TCP client.\n";
-                ret = false;
+            if (domain == AF_INET) {
+                int* sockopt_ptr = (int*)malloc(sizeof(int));
+                *sockopt_ptr = 1;
+                if( (setsockopt(this->socket_, SOL_SOCKET, SO_REUSEADDR, (char*)sockopt_ptr, sizeof(int)) == -1 )||
+                (setsockopt(this->socket_, SOL_SOCKET, SO_KEEPALIVE, (char*)sockopt_ptr, sizeof(int)) == -1 ) ){
+                    std::cerr << "Error setting TCP client.\n";
+                    ret = false;
+                }
             }
             ret = true;
         }
@@ -108,6 +156,34 @@ namespace core{
             }
             return true;
         }
+        /* connect to an AcceptorSocket bound in the abstract unix namespace (same host only) */
+        bool Connect(std::string uds_path) {
+            sockaddr_un server_addr;
+            memset(&server_addr, 0, sizeof(server_addr));
+            server_addr.sun_family = AF_UNIX;
+            if (uds_path.size() + 1 > sizeof(server_addr.sun_path)) {
+                std::cerr << "Error unix socket path too long.\n";
+                return false;
+            }
+            memcpy(server_addr.sun_path + 1, uds_path.data(), uds_path.size());
+            socklen_t addr_len = offsetof(sockaddr_un, sun_path) + 1 + uds_path.size();
+            if( connect( this->socket_, (sockaddr*)&server_addr, addr_len) == -1 ){
+                std::cerr << "Error connecting to unix socket server.\n";
+                return false;
+            }
+            return true;
+        }
+        bool SendFrame(uint32_t topic_id, const std::string &payload) {
+            return core::SendFrame(this->socket_, topic_id, payload);
+        }
+        /* links are bidirectional, the subscriber side sends credit frames back */
+        bool ReadFrame(uint32_t &topic_id, std::vector<char> &payload) {
+            return core::ReadFrame(this->socket_, topic_id, payload);
+        }
+        /* wake up a thread blocked on this socket, the fd stays valid until disconnect() */
+        void Shutdown() {
+            shutdown(this->socket_, SHUT_RDWR);
+        }
         bool Send(std::string data) {
             int bytecount;
             try {
@@ -161,6 +237,38 @@ namespace core{
             }
             ret = true;
         }
+        /* unix domain acceptor, autobound by the kernel to a unique abstract name (like tcp port 0) */
+        AcceptorSocket(std::string &uds_path, bool &ret) {
+            ret = false;
+            this->socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (this->socket_ < 0) {
+                std::cerr << "Error creating unix socket.\n";
+                return;
+            }
+            sockaddr_un serverAddr;
+            memset(&serverAddr, 0, sizeof(serverAddr));
+            serverAddr.sun_family = AF_UNIX;
+            if (bind(this->socket_, (sockaddr*)&serverAddr, sizeof(sa_family_t)) < 0) {
+                std::cerr << "Error binding unix socket.\n";
+                close(this->socket_);
+                return;
+            }
+            sockaddr_un addr;
+            socklen_t addr_len = sizeof(addr);
+            if (getsockname(this->socket_, (sockaddr*)&addr, &addr_len) != 0 ||
+                addr_len <= offsetof(sockaddr_un, sun_path) + 1) {
+                std::cerr << "Error resolving unix socket name.\n";
+                close(this->socket_);
+                return;
+            }
+            uds_path = std::string(addr.sun_path + 1, addr_len - offsetof(sockaddr_un, sun_path) - 1);
+            if(listen(this->socket_, 10) == -1 ){
+                std::cerr << "Error Listening.\n";
+                close(this->socket_);
+                return;
+            }
+            ret = true;
+        }
         void disconnect() {
             int result = close(this->socket_);
             if (result == 0) {
@@ -169,10 +277,14 @@ namespace core{
                 std::cerr << "Error closing acceptor socket\n";
             }
         }
+        /* a blocked Accept returns false from now on */
+        void Shutdown() {
+            shutdown(this->socket_, SHUT_RDWR);
+        }
         bool Accept(int &s_sock) {
             int sock;
-            socklen_t addr_size = sizeof(sockaddr_in);
-            sockaddr_in sadr;
+            socklen_t addr_size = sizeof(sockaddr_storage);
+            sockaddr_storage sadr;
             if((sock = accept( this->socket_, (sockaddr*)&sadr, &addr_size))!= -1) {
                 s_sock = sock;
                 return true;
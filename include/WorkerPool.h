@@ -0,0 +1,106 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed number of threads running jobs in arrival order, with a bounded backlog.
+ * Used by ServiceServer so a slow callback only holds up its own service. Jobs run on the
+ * caller's thread (in-process service calls) count against the same limit as the workers.
+ */
+namespace core {
+    class WorkerPool {
+        public:
+        WorkerPool(size_t workers, size_t max_queue) : max_queue(max_queue), limit(std::max<size_t>(workers, 1)), running(0), stopped(false) {
+            for (size_t i = 0; i < this->limit; i++) {
+                this->threads.emplace_back([this]() { this->work(); });
+            }
+        }
+        ~WorkerPool() {
+            this->stop();
+        }
+        /* false, and the job is not run, when max_queue jobs are already waiting or the pool stopped */
+        bool submit(std::function<void()> job) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->stopped || this->jobs.size() >= this->max_queue) return false;
+                this->jobs.push_back(std::move(job));
+            }
+            this->cv_.notify_one();
+            return true;
+        }
+        size_t size() const {
+            return this->limit;
+        }
+        /* runs job on this thread once fewer than workers jobs are running. false, and the job is not
+           run, if no slot freed up before deadline */
+        bool run(const std::function<void()> &job, std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max()) {
+            if (!this->acquire(deadline)) return false;
+            job();
+            this->release();
+            return true;
+        }
+        /* drops the jobs still waiting and joins the workers once their running jobs returned */
+        void stop() {
+            std::vector<std::thread> workers;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->stopped = true;
+                this->jobs.clear();
+                workers.swap(this->threads);
+            }
+            this->cv_.notify_all();
+            for (std::thread &worker : workers) {
+                if (worker.get_id() == std::this_thread::get_id()) worker.detach();
+                else worker.join();
+            }
+        }
+        private:
+        bool acquire(std::chrono::system_clock::time_point deadline) {
+            std::unique_lock<std::mutex> lock(this->slots_mutex_);
+            auto has_slot = [this]() { return this->running < this->limit; };
+            if (deadline == std::chrono::system_clock::time_point::max()) this->slots_cv_.wait(lock, has_slot);
+            else if (!this->slots_cv_.wait_until(lock, deadline, has_slot)) return false;
+            this->running++;
+            return true;
+        }
+        void release() {
+            {
+                std::lock_guard<std::mutex> lock(this->slots_mutex_);
+                this->running--;
+            }
+            this->slots_cv_.notify_one();
+        }
+        void work() {
+            while (1) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex_);
+                    this->cv_.wait(lock, [this]() { return this->stopped || !this->jobs.empty(); });
+                    if (this->stopped) return;
+                    job = std::move(this->jobs.front());
+                    this->jobs.pop_front();
+                }
+                this->run(job);
+            }
+        }
+        size_t max_queue;
+        size_t limit;
+        size_t running;
+        std::mutex slots_mutex_;
+        std::condition_variable slots_cv_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::function<void()> > jobs;
+        bool stopped;
+        std::vector<std::thread> threads;
+    };
+}
+
+#endif
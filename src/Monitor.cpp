@@ -0,0 +1,122 @@
+#include "NodeHandler.h"
+
+#include <cmath>
+
+/*
+ * grpccore_monitor [-w seconds] topic [topic ...]
+ * prints per topic message rate, inter-arrival jitter, bandwidth and message sizes every window,
+ * from raw frames so the message types are never parsed (nor needed).
+ */
+class TopicStats {
+    public:
+    TopicStats(std::string topic) : topic(topic) {
+        this->reset();
+    }
+    void add(uint32_t size) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->has_last) {
+            double dt = std::chrono::duration<double, std::milli>(now - this->last).count();
+            this->dt_min = std::min(this->dt_min, dt);
+            this->dt_max = std::max(this->dt_max, dt);
+            this->dt_sum += dt;
+            this->dt_sq_sum += dt * dt;
+            this->intervals++;
+        }
+        this->last = now;
+        this->has_last = true;
+        this->count++;
+        this->bytes += size;
+        this->size_min = std::min(this->size_min, size);
+        this->size_max = std::max(this->size_max, size);
+        /* power of two size buckets: [0,1], (1,2], (2,4], ... */
+        int bucket = 0;
+        while (bucket < 31 && (1u << bucket) < size) bucket++;
+        this->size_buckets[bucket]++;
+    }
+    void report(double window) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        std::cout << this->topic << ": ";
+        if (this->count == 0) {
+            std::cout << "no messages\n";
+            this->reset();
+            return;
+        }
+        std::cout << std::fixed << std::setprecision(1) << this->count / window << " Hz";
+        if (this->intervals > 0) {
+            double mean = this->dt_sum / this->intervals;
+            double stddev = std::sqrt(std::max(this->dt_sq_sum / this->intervals - mean * mean, 0.0));
+            std::cout << std::setprecision(3) << "  dt min " << this->dt_min << " max " << this->dt_max
+                      << " mean " << mean << " std " << stddev << " ms";
+        }
+        std::cout << std::setprecision(1) << "  " << this->bytes / window / 1024 << " KiB/s"
+                  << "  size min " << this->size_min << " avg " << (double)this->bytes / this->count << " max " << this->size_max << " B  [";
+        bool first = true;
+        for (int i = 0; i < 32; i++) {
+            if (this->size_buckets[i] == 0) continue;
+            std::cout << (first ? "" : " ") << "<=" << (1ull << i) << ":" << this->size_buckets[i];
+            first = false;
+        }
+        std::cout << "]\n";
+        this->reset();
+    }
+    private:
+    /* keeps last, so the first interval of the next window is measured too */
+    void reset() {
+        this->count = 0;
+        this->bytes = 0;
+        this->intervals = 0;
+        this->dt_min = INFINITY;
+        this->dt_max = 0;
+        this->dt_sum = 0;
+        this->dt_sq_sum = 0;
+        this->size_min = UINT32_MAX;
+        this->size_max = 0;
+        memset(this->size_buckets, 0, sizeof(this->size_buckets));
+    }
+    std::string topic;
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point last;
+    bool has_last = false;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t intervals;
+    double dt_min;
+    double dt_max;
+    double dt_sum;
+    double dt_sq_sum;
+    uint32_t size_min;
+    uint32_t size_max;
+    uint64_t size_buckets[32];
+};
+
+int main(int argc, char **argv) {
+    double window = 1.0;
+    std::vector<std::string> topics;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-w" && i + 1 < argc) window = atof(argv[++i]);
+        else topics.push_back(arg);
+    }
+    if (topics.empty() || window <= 0) {
+        std::cerr << "usage: " << argv[0] << " [-w seconds] topic [topic ...]\n";
+        return 1;
+    }
+    core::NodeHandler nh;
+    std::vector<std::unique_ptr<TopicStats> > stats;
+    for (const std::string &topic : topics) {
+        stats.emplace_back(new TopicStats(topic));
+        TopicStats *topic_stats = stats.back().get();
+        nh.subscribeRaw(topic, [topic_stats](const core::RawMessage &msg) {
+            topic_stats->add(msg.size);
+        });
+    }
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    while (1) {
+        next += std::chrono::microseconds((int64_t)(window * 1e6));
+        std::this_thread::sleep_until(next);
+        for (auto &topic_stats : stats) topic_stats->report(window);
+        std::cout << std::flush;
+    }
+    return 0;
+}
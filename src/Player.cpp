@@ -0,0 +1,111 @@
+#include "NodeHandler.h"
+#include "Mcap.h"
+
+#include <atomic>
+
+/*
+ * grpccore_play [-r speed] [-s seconds] [-f] file.mcap [topic ...]
+ * republishes a recording with its original timing, scaled by speed (-f: as fast as possible),
+ * starting -s seconds into the recording. SIMULATION builds drive the shared sim clock (Ticker)
+ * with the playback time so Rate::sleep() in the other processes follows the recording.
+ */
+std::atomic<bool> stop_playing(false);
+
+void handle_signal(int) {
+    stop_playing = true;
+}
+
+int main(int argc, char **argv) {
+    std::string path;
+    double speed = 1.0;
+    double start_offset = 0;
+    bool fast = false;
+    std::set<std::string> topics;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-r" && i + 1 < argc) speed = atof(argv[++i]);
+        else if (arg == "-s" && i + 1 < argc) start_offset = atof(argv[++i]);
+        else if (arg == "-f") fast = true;
+        else if (path.empty()) path = arg;
+        else topics.insert(arg);
+    }
+    if (path.empty() || speed <= 0) {
+        std::cerr << "usage: " << argv[0] << " [-r speed] [-s seconds] [-f] file.mcap [topic ...]\n";
+        return 1;
+    }
+    bool ret = false;
+    core::McapReader reader(path, ret);
+    if (!ret) return 1;
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    /* message types come from the schemas in the file, so this tool does not need them compiled in */
+    google::protobuf::DescriptorPool pool;
+    /* the node threads outlive main, the node is never destroyed */
+    core::NodeHandler *nh = new core::NodeHandler();
+    std::map<uint16_t, core::RawPublisher*> publishers;
+    for (auto &pair : reader.channels) {
+        const core::McapReader::Channel &channel = pair.second;
+        if (!topics.empty() && topics.count(channel.topic) == 0) continue;
+        std::string type_name;
+        const google::protobuf::Descriptor *descriptor = nullptr;
+        auto schema = reader.schemas.find(channel.schema_id);
+        if (schema != reader.schemas.end() && schema->second.encoding == "protobuf") {
+            type_name = schema->second.name;
+            google::protobuf::FileDescriptorSet set;
+            if (set.ParseFromString(schema->second.data)) {
+                for (const google::protobuf::FileDescriptorProto &file : set.file()) {
+                    if (!pool.FindFileByName(file.name())) pool.BuildFile(file);
+                }
+            }
+            descriptor = pool.FindMessageTypeByName(type_name);
+        }
+        publishers[pair.first] = &nh->advertiseRaw(channel.topic, type_name, 1000, descriptor);
+        std::cout << "Playing " << channel.topic << " [" << type_name << "]\n";
+    }
+    /* give the subscribers a moment to connect before the first message, topics nobody listens to
+       do not hold up the others for long */
+    std::chrono::steady_clock::time_point connect_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    for (auto &pair : publishers) {
+        std::chrono::milliseconds left = std::chrono::duration_cast<std::chrono::milliseconds>(connect_deadline - std::chrono::steady_clock::now());
+        if (!pair.second->waitForMatched(1, std::max(left, std::chrono::milliseconds(0)))) {
+            std::cout << "No subscriber for " << reader.channels[pair.first].topic << " yet\n";
+        }
+    }
+
+    uint64_t from = reader.start_time + (uint64_t)(start_offset * 1e9);
+    uint64_t first_time = 0;
+    uint64_t count = 0;
+    std::chrono::steady_clock::time_point wall_start;
+#ifdef SIMULATION
+    std::unique_ptr<core::Ticker> ticker(new core::Ticker());
+#endif
+    reader.read(from, [&](const core::McapReader::Message &msg) {
+        if (stop_playing) return false;
+        auto iter = publishers.find(msg.channel_id);
+        if (iter == publishers.end()) return true;
+        if (count == 0) {
+            first_time = msg.log_time;
+            wall_start = std::chrono::steady_clock::now();
+        }
+        uint64_t elapsed_ns = msg.log_time - first_time;
+        if (!fast) {
+            std::this_thread::sleep_until(wall_start + std::chrono::nanoseconds((int64_t)(elapsed_ns / speed)));
+        }
+#ifdef SIMULATION
+        ticker->tick(elapsed_ns / 1000);
+#endif
+        iter->second->publish(msg.data, msg.size);
+        count++;
+        return true;
+    });
+    std::cout << "Played " << count << " messages from " << path << std::endl;
+    /* let the links write out the last messages before leaving */
+    for (auto &pair : publishers) {
+        if (!pair.second->drain(std::chrono::seconds(2))) std::cerr << "Subscribers of " << reader.channels[pair.first].topic << " did not take every message\n";
+    }
+#ifdef SIMULATION
+    ticker.reset();
+#endif
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "NodeHandler.h"
+#include "Mcap.h"
+
+#include <atomic>
+#include <ctime>
+
+/*
+ * grpccore_record [-o file.mcap] [-c zstd] [-s chunk_bytes] [-a] topic [topic ...]
+ * records the given topics as raw frames into an MCAP file until Ctrl-C.
+ * -a also records every topic the master knows about, including the ones advertised later.
+ */
+std::atomic<bool> stop_recording(false);
+
+void handle_signal(int) {
+    stop_recording = true;
+}
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char **argv) {
+    std::string path;
+    std::string compression;
+    size_t chunk_size = 4 << 20;
+    bool all_topics = false;
+    std::vector<std::string> topics;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) path = argv[++i];
+        else if (arg == "-c" && i + 1 < argc) compression = argv[++i];
+        else if (arg == "-s" && i + 1 < argc) chunk_size = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "-a") all_topics = true;
+        else topics.push_back(arg);
+    }
+    if (topics.empty() && !all_topics) {
+        std::cerr << "usage: " << argv[0] << " [-o file.mcap] [-c zstd] [-s chunk_bytes] [-a] topic [topic ...]\n";
+        return 1;
+    }
+    if (path.empty()) {
+        char name[64];
+        time_t now = time(nullptr);
+        strftime(name, sizeof(name), "record_%Y%m%d_%H%M%S.mcap", localtime(&now));
+        path = name;
+    }
+    bool ret = false;
+    /* the node and subscriber threads outlive main and keep writing to it, it is closed but never destroyed */
+    core::McapWriter *writer = new core::McapWriter(path, compression, chunk_size, ret);
+    if (!ret) return 1;
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    core::NodeHandler *nh = new core::NodeHandler();
+    std::mutex *topics_mutex = new std::mutex();
+    std::set<std::string> *recording = new std::set<std::string>();
+    auto record = [nh, writer, topics_mutex, recording, all_topics](const std::string &topic) {
+        std::lock_guard<std::mutex> lock(*topics_mutex);
+        if (!recording->insert(topic).second) return;
+        uint16_t channel_id = writer->add_channel(topic);
+        nh->subscribeRaw(topic, [writer, channel_id](const core::RawMessage &msg) {
+            writer->write(channel_id, msg.type_name, now_ns(), msg.data, msg.size);
+        });
+        if (all_topics) std::cout << "Recording " << topic << "\n";
+    };
+    for (const std::string &topic : topics) record(topic);
+    if (all_topics && !nh->stub_) {
+        std::cerr << "-a needs the master's graph, it is not available with multicast discovery\n";
+        all_topics = false;
+    }
+    if (all_topics) {
+        std::thread([nh, record]() {
+            grpc::ClientContext context;
+            core::GraphRequest request;
+            core::Graph graph;
+            std::unique_ptr<grpc::ClientReader<core::Graph> > stream(nh->stub_->WatchGraph(&context, request));
+            while (stream->Read(&graph)) {
+                /* topics with only subscribers have nothing to record yet */
+                for (const core::GraphTopic &topic : graph.topics()) {
+                    if (topic.publishers_size() > 0) record(topic.topic_name());
+                }
+            }
+            std::cerr << "Lost the graph stream from the master, no new topics will be recorded\n";
+        }).detach();
+        std::cout << "Recording all topics to " << path << "\n";
+    }
+    else std::cout << "Recording " << topics.size() << " topics to " << path << "\n";
+    while (!stop_recording) usleep(100000);
+    /* later messages are ignored by the closed writer */
+    writer->close();
+    std::cout << "Recorded " << writer->messages() << " messages to " << path << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+#include <atomic>
+
+/*
+ * An action reports feedback until it reaches its goal, and a goal cancelled mid-feedback ends for
+ * the client right away, while the callback finds out from cancelled() and returns on its own time.
+ * A goal the server turns away ends once, even when the client cancels it at the same moment.
+ */
+using Goal = config_msg::ConfigStamped;
+
+std::atomic<bool> cancel_seen(false);
+std::atomic<bool> callback_returned(false);
+
+/* counts up to goal.address(), one feedback every 10 ms */
+void count(Goal goal, core::ActionHandle<Goal> &handle, Goal &result) {
+    int i = 0;
+    for (; i < goal.address() && !handle.cancelled(); i++) {
+        Goal feedback;
+        feedback.set_value_i(i);
+        handle.feedback(feedback);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (handle.cancelled()) {
+        cancel_seen = true;
+        /* a slow cleanup, the client does not wait for it */
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        /* the call is gone, this goes nowhere */
+        handle.feedback(Goal());
+    }
+    result.set_value_i(i);
+    callback_returned = true;
+}
+
+std::atomic<int> feedbacks(0);
+std::atomic<int> last_feedback(-1);
+
+int main() {
+    test::useMaster();
+    /* the node threads outlive main, the nodes are never destroyed */
+    core::NodeHandler *server_node = new core::NodeHandler();
+    core::NodeHandler *client_node = new core::NodeHandler();
+    server_node->actionServer<Goal, Goal, Goal>("count", count);
+    /* no backlog at all, every goal is refused */
+    core::ServiceOptions refusing;
+    refusing.max_queue = 0;
+    server_node->actionServer<Goal, Goal, Goal>("refused", count, refusing);
+    core::ActionClient<Goal, Goal, Goal> &client = client_node->actionClient<Goal, Goal, Goal>("count");
+    core::ActionClient<Goal, Goal, Goal> &refused = client_node->actionClient<Goal, Goal, Goal>("refused");
+    CHECK(client.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(refused.waitForMatched(1, std::chrono::seconds(5)));
+
+    /* to the end: feedback in order, then the result */
+    Goal goal;
+    goal.set_address(20);
+    Goal result;
+    CHECK(client.pull_result(goal, result, [](const Goal &feedback) {
+        CHECK(feedback.value_i() > last_feedback);
+        last_feedback = feedback.value_i();
+        feedbacks++;
+    }));
+    CHECK(result.value_i() == 20);
+    CHECK(feedbacks > 0 && last_feedback <= 19);
+    CHECK(callback_returned);
+
+    /* cancelled mid-feedback */
+    callback_returned = false;
+    feedbacks = 0;
+    goal.set_address(1000000);
+    std::shared_ptr<core::GoalHandle<Goal> > handle = client.send_goal(goal, [](const Goal &feedback) { feedbacks++; });
+    CHECK(test::eventually([]() { return feedbacks >= 3; }));
+    handle->cancel();
+    /* the call ends long before the callback returns */
+    CHECK(handle->wait_for(std::chrono::milliseconds(500)));
+    CHECK(!handle->wait(result));
+    CHECK(test::eventually([]() { return cancel_seen.load(); }));
+    CHECK(!callback_returned);
+    CHECK(test::eventually([]() { return callback_returned.load(); }));
+
+    /* the worker is free again once the callback returned */
+    goal.set_address(3);
+    CHECK(client.pull_result(goal, result));
+    CHECK(result.value_i() == 3);
+
+    for (int i = 0; i < 50; i++) {
+        std::shared_ptr<core::GoalHandle<Goal> > refused_handle = refused.send_goal(goal);
+        refused_handle->cancel();
+        CHECK(!refused_handle->wait(result));
+    }
+    std::cout << "ActionTest passed\n";
+    return 0;
+}
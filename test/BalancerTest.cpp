@@ -0,0 +1,71 @@
+#include "Balancer.h"
+#include "Check.h"
+
+#include <map>
+
+/* which server each policy picks, the channels are never connected */
+std::shared_ptr<grpc::Channel> channel() {
+    return grpc::CreateChannel("127.0.0.1:1", grpc::InsecureChannelCredentials());
+}
+
+core::ServerPool *pool(core::Balance balance, int servers) {
+    core::ServerPool *pool = new core::ServerPool(balance);
+    for (int i = 0; i < servers; i++) CHECK(pool->add("server" + std::to_string(i), channel()));
+    return pool;
+}
+
+int main() {
+    /* nothing to pick from */
+    core::ServerPool empty(core::Balance::ROUND_ROBIN);
+    CHECK(!empty.pick());
+
+    /* round robin takes turns, whatever is outstanding */
+    core::ServerPool *round_robin = pool(core::Balance::ROUND_ROBIN, 3);
+    CHECK(!round_robin->add("server1", channel()));
+    CHECK(round_robin->size() == 3);
+    std::map<std::string, int> picked;
+    for (int i = 0; i < 30; i++) picked[round_robin->pick()->key]++;
+    CHECK(picked.size() == 3);
+    for (auto &pair : picked) CHECK(pair.second == 10);
+
+    /* least outstanding avoids the busy servers, and goes back once they are done */
+    core::ServerPool *least = pool(core::Balance::LEAST_OUTSTANDING, 3);
+    core::ServerPool::ServerPtr first = least->pick();
+    core::ServerPool::ServerPtr second = least->pick();
+    CHECK(first->key != second->key);
+    core::ServerPool::ServerPtr third = least->pick();
+    CHECK(third->key != first->key && third->key != second->key);
+    for (int i = 0; i < 10; i++) least->pick();
+    least->done(first);
+    least->done(first);
+    CHECK(first->outstanding < second->outstanding && first->outstanding < third->outstanding);
+    CHECK(least->pick() == first);
+
+    /* power of two never picks the busier of two servers */
+    core::ServerPool *two = pool(core::Balance::POWER_OF_TWO, 2);
+    core::ServerPool::ServerPtr busy = two->pick();
+    for (int i = 0; i < 20; i++) busy->outstanding++;
+    for (int i = 0; i < 20; i++) {
+        core::ServerPool::ServerPtr server = two->pick();
+        CHECK(server != busy);
+        two->done(server);
+    }
+    /* with more servers the busy one is only picked against an even busier one */
+    core::ServerPool *many = pool(core::Balance::POWER_OF_TWO, 8);
+    busy = many->pick();
+    busy->outstanding += 1000;
+    for (int i = 0; i < 200; i++) {
+        core::ServerPool::ServerPtr server = many->pick();
+        CHECK(server != busy);
+        many->done(server);
+    }
+
+    /* a removed server is no longer picked, calls already holding it still finish */
+    core::ServerPool::ServerPtr held = round_robin->pick();
+    CHECK(round_robin->remove(held->key));
+    CHECK(!round_robin->remove(held->key));
+    for (int i = 0; i < 10; i++) CHECK(round_robin->pick()->key != held->key);
+    round_robin->done(held);
+    std::cout << "BalancerTest passed\n";
+    return 0;
+}
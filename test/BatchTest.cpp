@@ -0,0 +1,87 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+#include <atomic>
+
+/*
+ * A batch goes out in one call and its replies come back in request order, whether the server ran
+ * the requests one after another (in_order) or several at once and they finished out of order.
+ */
+using Message = config_msg::ConfigStamped;
+
+std::mutex order_mutex;
+std::vector<int> finished;
+std::atomic<int> running(0);
+std::atomic<int> most_running(0);
+
+/* sleeps value_i ms, answers with its address */
+void work(Message request, Message &reply) {
+    int now = ++running;
+    int seen = most_running;
+    while (now > seen && !most_running.compare_exchange_weak(seen, now)) {}
+    std::this_thread::sleep_for(std::chrono::milliseconds(request.value_i()));
+    reply.set_address(request.address());
+    {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        finished.push_back(request.address());
+    }
+    running--;
+}
+
+void reset() {
+    std::lock_guard<std::mutex> lock(order_mutex);
+    finished.clear();
+    most_running = 0;
+}
+
+int main() {
+    test::useMaster();
+    /* the node threads outlive main, the nodes are never destroyed */
+    core::NodeHandler *server_node = new core::NodeHandler();
+    core::NodeHandler *client_node = new core::NodeHandler();
+    core::ServiceOptions options;
+    options.concurrency = 4;
+    server_node->serviceServer<Message, Message>("work", work, options);
+    core::ServiceClient<Message, Message> &client = client_node->serviceClient<Message, Message>("work");
+    CHECK(client.waitForMatched(1, std::chrono::seconds(5)));
+
+    /* the first requests take longest, so run at once they finish last */
+    std::vector<Message> requests(8);
+    for (int i = 0; i < 8; i++) {
+        requests[i].set_address(i);
+        requests[i].set_value_i(10 * (8 - i));
+    }
+    std::vector<Message> replies;
+
+    CHECK(client.pull_batch(requests, replies, true));
+    CHECK(replies.size() == 8);
+    for (int i = 0; i < 8; i++) CHECK(replies[i].address() == i);
+    CHECK(most_running == 1);
+    for (int i = 0; i < 8; i++) CHECK(finished[i] == i);
+
+    reset();
+    CHECK(client.pull_batch(requests, replies, false));
+    CHECK(replies.size() == 8);
+    for (int i = 0; i < 8; i++) CHECK(replies[i].address() == i);
+    CHECK(most_running > 1 && most_running <= 4);
+    /* they did finish out of order */
+    CHECK(finished.size() == 8 && finished[0] != 0);
+
+    /* an empty batch is a valid one */
+    CHECK(client.pull_batch(std::vector<Message>(), replies, false));
+    CHECK(replies.empty());
+    /* these two names have the same id, the second one is refused and the node lives on */
+    auto noop = [](Message, Message&) {};
+    server_node->serviceServer<Message, Message>("service_422789", noop);
+    bool thrown = false;
+    try {
+        server_node->serviceServer<Message, Message>("service_639192", noop);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(client.pull_batch(requests, replies, false));
+    std::cout << "BatchTest passed\n";
+    return 0;
+}
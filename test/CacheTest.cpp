@@ -0,0 +1,78 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+#include <atomic>
+
+/*
+ * Cached replies never outlive a write through the same client: the cache is invalidated when the
+ * write goes out and again when its reply arrives, so a read that overtook the write on the server
+ * and came back with the old value is not stored.
+ */
+using Message = config_msg::ConfigStamped;
+
+std::atomic<int> value(1);
+std::atomic<int> reads(0);
+
+/* READ answers value, WRITE sets it to value_i after value_f seconds */
+void store(Message request, Message &reply) {
+    if (request.mode() == config_msg::WRITE) {
+        std::this_thread::sleep_for(std::chrono::milliseconds((int)(request.value_f() * 1000)));
+        value = request.value_i();
+    }
+    else reads++;
+    reply.set_value_i(value);
+}
+
+Message reading() {
+    Message request;
+    request.set_mode(config_msg::READ);
+    return request;
+}
+
+Message writing(int new_value, float delay) {
+    Message request;
+    request.set_mode(config_msg::WRITE);
+    request.set_value_i(new_value);
+    request.set_value_f(delay);
+    return request;
+}
+
+int main() {
+    test::useMaster();
+    /* the node threads outlive main, the nodes are never destroyed */
+    core::NodeHandler *server_node = new core::NodeHandler();
+    core::NodeHandler *client_node = new core::NodeHandler();
+    core::ServiceOptions options;
+    options.concurrency = 2;
+    server_node->serviceServer<Message, Message>("store", store, options);
+    core::ServiceClient<Message, Message> &client = client_node->serviceClient<Message, Message>("store");
+    CHECK(client.waitForMatched(1, std::chrono::seconds(5)));
+    /* without a predicate nothing is cached, rather than every call throwing */
+    CHECK(!client.enable_cache(std::chrono::seconds(60), nullptr));
+    CHECK(client.enable_cache(std::chrono::seconds(60), [](const Message &request) { return request.mode() == config_msg::READ; }));
+    Message reply;
+
+    CHECK(client.pull_request(reading(), reply) && reply.value_i() == 1);
+    CHECK(client.pull_request(reading(), reply) && reply.value_i() == 1);
+    CHECK(reads == 1 && client.cache_hits() == 1);
+
+    /* a batch of reads the cache holds is answered from it */
+    std::vector<Message> replies;
+    CHECK(client.pull_batch({reading(), reading()}, replies) && replies.size() == 2 && replies[1].value_i() == 1);
+    CHECK(reads == 1 && client.cache_hits() == 3);
+
+    /* the read runs on the server while the write still sleeps, it sees the old value */
+    std::future<Message> write = client.callAsync(writing(2, 0.3));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(client.pull_request(reading(), reply) && reply.value_i() == 1);
+    CHECK(write.get().value_i() == 2);
+    CHECK(client.pull_request(reading(), reply) && reply.value_i() == 2);
+    CHECK(reads == 3);
+
+    /* a write in a batch drops what the batch's reads cached */
+    CHECK(client.pull_batch({reading(), writing(3, 0)}, replies, true) && replies[1].value_i() == 3);
+    CHECK(client.pull_request(reading(), reply) && reply.value_i() == 3);
+    std::cout << "CacheTest passed\n";
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+/*
+ * Each test is a plain executable run by ctest, it exits non-zero at the first failed CHECK.
+ * Tests with nodes run their own master in the process, on a port derived from the pid so
+ * several tests can run at once.
+ */
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond "\n"; \
+            exit(1); \
+        } \
+    } while (0)
+
+namespace test {
+    /* TestMaster.cpp, runs core::RunServer on its own thread */
+    void startMaster(const std::string &address);
+    /* environment for the NodeHandlers of this test, call before the first one */
+    inline void useMaster() {
+        std::string address = "127.0.0.1:" + std::to_string(20000 + getpid() % 20000);
+        setenv("CORE_LOCAL_IP", "127.0.0.1", 1);
+        setenv("CORE_MASTER_ADDR", address.c_str(), 1);
+        unsetenv("CORE_DISCOVERY");
+        startMaster(address);
+    }
+    /* true once cond holds, false if it did not within timeout */
+    inline bool eventually(std::function<bool()> cond, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + timeout;
+        while (!cond()) {
+            if (std::chrono::steady_clock::now() > end) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+#include <atomic>
+
+/*
+ * A call past its deadline fails and counts as a timeout, whether the server is in the same node
+ * (called directly) or in another one. Every call that reached the server shows in latencies(). An
+ * in-process call does not wait past its deadline for a busy server either.
+ */
+using Message = config_msg::ConfigStamped;
+
+std::atomic<int> served(0);
+
+/* sleeps value_i ms */
+void slow(Message request, Message &reply) {
+    served++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(request.value_i()));
+    reply.set_address(request.address());
+}
+
+Message taking(int ms) {
+    Message request;
+    request.set_value_i(ms);
+    return request;
+}
+
+int main() {
+    test::useMaster();
+    /* the node threads outlive main, the nodes are never destroyed */
+    core::NodeHandler *server_node = new core::NodeHandler();
+    core::NodeHandler *client_node = new core::NodeHandler();
+    server_node->serviceServer<Message, Message>("slow", slow);
+    core::ServiceClient<Message, Message> &local = server_node->serviceClient<Message, Message>("slow");
+    core::ServiceClient<Message, Message> &remote = client_node->serviceClient<Message, Message>("slow");
+    CHECK(local.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(remote.waitForMatched(1, std::chrono::seconds(5)));
+    local.set_timeout(std::chrono::milliseconds(50));
+    remote.set_timeout(std::chrono::milliseconds(50));
+    Message reply;
+
+    CHECK(!local.pull_request(taking(200), reply));
+    CHECK(local.timeouts() == 1 && local.latencies().count() == 1);
+    CHECK(local.pull_request(taking(0), reply));
+    CHECK(local.timeouts() == 1 && local.latencies().count() == 2);
+
+    /* the requests after the deadline are not served */
+    served = 0;
+    std::vector<Message> replies;
+    CHECK(!local.pull_batch({taking(40), taking(40), taking(40)}, replies));
+    CHECK(replies.empty() && served == 2);
+    CHECK(local.timeouts() == 2 && local.latencies().count() == 3);
+
+    bool failed = false;
+    try {
+        local.callAsync(taking(200)).get();
+    } catch (const std::runtime_error &error) {
+        failed = true;
+    }
+    CHECK(failed && local.timeouts() == 3 && local.latencies().count() == 4);
+
+    /* a busy in-process server fails the call at its deadline, it does not wait for the worker */
+    std::future<Message> busy = local.callAsync(taking(300));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CHECK(!local.pull_request(taking(0), reply));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(200));
+    CHECK(local.timeouts() == 4);
+
+    CHECK(!remote.pull_request(taking(200), reply));
+    CHECK(remote.timeouts() == 1 && remote.latencies().count() == 1);
+    std::cout << "DeadlineTest passed\n";
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+/*
+ * Stopping a node's streams ends its lease at once, the stream threads are joined before stop()
+ * returns. The master then evicts the node and the publishers on other nodes drop their links to
+ * its subscribers.
+ */
+void on_config(config_msg::ConfigStamped msg) {}
+
+int main() {
+    test::useMaster();
+    /* the node threads outlive main, the nodes are never destroyed */
+    core::NodeHandler *publisher_node = new core::NodeHandler();
+    core::NodeHandler *subscriber_node = new core::NodeHandler();
+
+    core::Publisher<config_msg::ConfigStamped> &pub = publisher_node->advertise<config_msg::ConfigStamped>("evicted_topic", 10);
+    subscriber_node->subscribe<config_msg::ConfigStamped>("evicted_topic", 0, on_config, 10);
+    CHECK(pub.waitForMatched(1, std::chrono::seconds(5)));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    subscriber_node->streams.stop();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+    CHECK(subscriber_node->streams.stopped());
+    CHECK(test::eventually([&]() { return pub.matched() == 0; }));
+    std::cout << "EvictionTest passed\n";
+    return 0;
+}
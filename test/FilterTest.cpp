@@ -0,0 +1,76 @@
+#include "Filter.h"
+#include "Check.h"
+#include "Config.pb.h"
+#include "Motor.pb.h"
+#include "Power.pb.h"
+#include "serviceserving.pb.h"
+
+/* Filter predicates as the subscriber writes them, evaluated the way the publisher does */
+template<class M>
+bool accepts(const core::Filter &filter, const M &msg) {
+    return core::CompiledFilter(M::descriptor(), filter.predicates).matches(msg);
+}
+template<class M>
+std::string error(const core::Filter &filter, const M &msg) {
+    return core::CompiledFilter(M::descriptor(), filter.predicates).error();
+}
+
+int main() {
+    config_msg::ConfigStamped config;
+    config.set_address(42);
+    config.set_mode(config_msg::WRITE);
+    config.set_value_f(0.1f);
+    config.mutable_header()->set_frameid("module_a");
+
+    /* every operator on an integer field */
+    CHECK(accepts(core::Filter().where("address", core::FieldFilter::EQ, 42), config));
+    CHECK(!accepts(core::Filter().where("address", core::FieldFilter::NE, 42), config));
+    CHECK(accepts(core::Filter().where("address", core::FieldFilter::LT, 43), config));
+    CHECK(!accepts(core::Filter().where("address", core::FieldFilter::LT, 42), config));
+    CHECK(accepts(core::Filter().where("address", core::FieldFilter::LE, 42), config));
+    CHECK(accepts(core::Filter().where("address", core::FieldFilter::GT, 41), config));
+    CHECK(!accepts(core::Filter().where("address", core::FieldFilter::GE, 43), config));
+    /* all predicates have to hold */
+    CHECK(!accepts(core::Filter().where("address", core::FieldFilter::GT, 0).where("address", core::FieldFilter::LT, 10), config));
+    /* enums by name and by number, strings in nested messages */
+    CHECK(accepts(core::Filter().where("mode", core::FieldFilter::EQ, "WRITE"), config));
+    CHECK(accepts(core::Filter().where("mode", core::FieldFilter::EQ, (int)config_msg::WRITE), config));
+    CHECK(!accepts(core::Filter().where("mode", core::FieldFilter::EQ, "READ"), config));
+    CHECK(accepts(core::Filter().where("header.frameid", core::FieldFilter::EQ, "module_a"), config));
+    CHECK(accepts(core::Filter().where("header.frameid", core::FieldFilter::GT, "module"), config));
+    /* a float compares equal to the float it was set from */
+    CHECK(accepts(core::Filter().where("value_f", core::FieldFilter::EQ, 0.1f), config));
+    /* predicates the type cannot evaluate are reported, the publisher refuses such a subscription */
+    CHECK(error(core::Filter().where("address", core::FieldFilter::EQ, 42), config).empty());
+    CHECK(!error(core::Filter().where("no_such_field", core::FieldFilter::EQ, 1), config).empty());
+    CHECK(!error(core::Filter().where("header", core::FieldFilter::EQ, 1), config).empty());
+    CHECK(!error(core::Filter().where("address.x", core::FieldFilter::EQ, 1), config).empty());
+    CHECK(!error(core::Filter().where("address", core::FieldFilter::GE, "ERROR"), config).empty());
+    CHECK(!error(core::Filter().where("mode", core::FieldFilter::EQ, "WRITTEN"), config).empty());
+
+    /* doubles keep their precision: to_string would turn 1e-7 into "0.000000" */
+    motor_msg::MotorState state;
+    state.set_theta(5e-8);
+    CHECK(accepts(core::Filter().where("theta", core::FieldFilter::LT, 1e-7), state));
+    CHECK(!accepts(core::Filter().where("theta", core::FieldFilter::LT, 1e-8), state));
+    CHECK(accepts(core::Filter().where("theta", core::FieldFilter::EQ, 5e-8), state));
+    state.set_beta(1e20);
+    CHECK(accepts(core::Filter().where("beta", core::FieldFilter::EQ, 1e20), state));
+    CHECK(accepts(core::Filter().where("beta", core::FieldFilter::LT, 1.0000001e20), state));
+
+    power_msg::PowerStateStamped power;
+    power.set_digital(true);
+    CHECK(accepts(core::Filter().where("digital", core::FieldFilter::EQ, true), power));
+    CHECK(accepts(core::Filter().where("digital", core::FieldFilter::EQ, "true"), power));
+    CHECK(!accepts(core::Filter().where("power", core::FieldFilter::EQ, true), power));
+    CHECK(!error(core::Filter().where("digital", core::FieldFilter::EQ, "yes"), power).empty());
+
+    /* a repeated field matches when any element does */
+    core::CallBatchRequest batch;
+    batch.add_payloads("a");
+    batch.add_payloads("b");
+    CHECK(accepts(core::Filter().where("payloads", core::FieldFilter::EQ, "b"), batch));
+    CHECK(!accepts(core::Filter().where("payloads", core::FieldFilter::EQ, "c"), batch));
+    std::cout << "FilterTest passed\n";
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "Link.h"
+#include "Check.h"
+
+/*
+ * A subscriber that stops granting credits only costs its own messages: pushing to its BLOCK
+ * channel never waits, the other subscribers of the publisher keep receiving, and what waited
+ * past block_timeout_ms is dropped at the publisher.
+ */
+struct Received {
+    std::mutex mutex_;
+    std::vector<std::string> frames;
+    std::shared_ptr<core::InLink> link;
+    uint32_t id;
+    size_t size() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return this->frames.size();
+    }
+    bool has(const std::string &frame) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return std::find(this->frames.begin(), this->frames.end(), frame) != this->frames.end();
+    }
+};
+
+int main() {
+    core::LinkManager *blocked_node = new core::LinkManager("127.0.0.1");
+    core::LinkManager *dropping_node = new core::LinkManager("127.0.0.1");
+    core::LinkManager *publisher = new core::LinkManager("127.0.0.1");
+    Received *blocked = new Received();
+    Received *dropping = new Received();
+    /* never reports a frame consumed until the test does it below */
+    uint32_t blocked_id = blocked_node->add_sink([blocked](const char *data, uint32_t size, const std::shared_ptr<core::InLink> &link) {
+        std::lock_guard<std::mutex> lock(blocked->mutex_);
+        blocked->frames.push_back(std::string(data, size));
+        blocked->link = link;
+    });
+    dropping->id = dropping_node->add_sink([dropping](const char *data, uint32_t size, const std::shared_ptr<core::InLink> &link) {
+        {
+            std::lock_guard<std::mutex> lock(dropping->mutex_);
+            dropping->frames.push_back(std::string(data, size));
+        }
+        link->consumed(dropping->id, 2);
+    });
+    core::FlowControl block;
+    block.set_policy(core::FlowControl::BLOCK);
+    block.set_credits(2);
+    block.set_block_timeout_ms(300);
+    core::FlowControl drop_oldest;
+    drop_oldest.set_credits(2);
+    std::shared_ptr<core::OutLink> blocked_link = publisher->link_to(blocked_node->ip, blocked_node->tcp_port, blocked_node->uds_path);
+    std::shared_ptr<core::OutLink> dropping_link = publisher->link_to(dropping_node->ip, dropping_node->tcp_port, dropping_node->uds_path);
+    CHECK(blocked_link && dropping_link);
+    std::shared_ptr<core::OutChannel> blocked_channel = blocked_link->add_channel(blocked_id, 0, 4, block);
+    std::shared_ptr<core::OutChannel> dropping_channel = dropping_link->add_channel(dropping->id, 0, 4, drop_oldest);
+
+    /* the way Publisher::send fans out a message: one push per subscriber, in a row */
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++) {
+        std::string frame = std::to_string(i);
+        CHECK(blocked_channel->push(std::make_shared<const std::string>(frame)));
+        CHECK(dropping_channel->push(std::make_shared<const std::string>(frame)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    /* a waiting push would take block_timeout_ms per message over the queue size */
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    CHECK(test::eventually([&]() { return dropping->has("99"); }));
+    /* the BLOCK subscriber got its initial credits worth */
+    CHECK(test::eventually([&]() { return blocked->size() == 2; }));
+    CHECK(blocked->frames[0] == "0" && blocked->frames[1] == "1");
+
+    /* past the timeout only the frames that found room in the queue are left */
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    for (int i = 0; i < 10; i++) blocked->link->consumed(blocked_id, 2);
+    CHECK(test::eventually([&]() { return blocked->size() == 6; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(blocked->size() == 6);
+    for (int i = 2; i < 6; i++) CHECK(blocked->frames[i] == std::to_string(i));
+
+    /* the 6 credits left are used by the next frames, within the timeout the ones over the queue size too */
+    for (int i = 100; i < 106; i++) CHECK(blocked_channel->push(std::make_shared<const std::string>(std::to_string(i))));
+    CHECK(test::eventually([&]() { return blocked->size() == 12; }));
+    for (int i = 6; i < 12; i++) CHECK(blocked->frames[i] == std::to_string(94 + i));
+    std::cout << "FlowControlTest passed\n";
+    return 0;
+}
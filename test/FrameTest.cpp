@@ -0,0 +1,58 @@
+#include "TCPSocket.h"
+#include "Check.h"
+
+#include <sys/socket.h>
+
+/* the link framing: [payload size : le32][topic id : le32][payload], see TCPSocket.h */
+int main() {
+    int socks[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0);
+    /* header bytes on the wire */
+    CHECK(core::SendFrame(socks[0], 0x01020304, "abc"));
+    char raw[11];
+    CHECK(recv(socks[1], raw, sizeof(raw), MSG_WAITALL) == sizeof(raw));
+    const char expected[] = {3, 0, 0, 0, 4, 3, 2, 1, 'a', 'b', 'c'};
+    CHECK(memcmp(raw, expected, sizeof(raw)) == 0);
+
+    /* round trips, large frames need a concurrent reader */
+    std::vector<std::pair<uint32_t, std::string> > frames = {
+        {1, ""}, {2, "x"}, {0xffffffff, std::string(1 << 20, 'y')}, {7, std::string(65537, '\0')}, {3, "last"}};
+    std::thread writer([&]() {
+        for (auto &frame : frames) CHECK(core::SendFrame(socks[0], frame.first, frame.second));
+    });
+    std::vector<char> payload;
+    for (auto &frame : frames) {
+        uint32_t topic_id = 0;
+        CHECK(core::ReadFrame(socks[1], topic_id, payload));
+        CHECK(topic_id == frame.first);
+        CHECK(std::string(payload.data(), payload.size()) == frame.second);
+    }
+    writer.join();
+
+    uint8_t header[core::FRAME_HEADER_SIZE];
+    /* a size over the limit is not allocated, it fails the read */
+    {
+        int bad[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, bad) == 0);
+        google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(0xfffffff0, header);
+        google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(1, header + 4);
+        CHECK(send(bad[0], header, sizeof(header), 0) == sizeof(header));
+        uint32_t topic_id;
+        CHECK(!core::ReadFrame(bad[1], topic_id, payload));
+        close(bad[0]);
+        close(bad[1]);
+    }
+
+    /* a frame cut short by the peer closing is an error, not a short payload */
+    google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(100, header);
+    google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(5, header + 4);
+    CHECK(send(socks[0], header, sizeof(header), 0) == sizeof(header));
+    CHECK(send(socks[0], "short", 5, 0) == 5);
+    close(socks[0]);
+    uint32_t topic_id;
+    CHECK(!core::ReadFrame(socks[1], topic_id, payload));
+    CHECK(!core::ReadFrame(socks[1], topic_id, payload));
+    close(socks[1]);
+    std::cout << "FrameTest passed\n";
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "Master.h"
+#include "Check.h"
+
+/* a watcher that is told about every snapshot, and can be made busy like a stream still writing */
+struct Watcher : core::MasterGraph::Listener {
+    bool busy = false;
+    bool pending = false;
+    std::vector<std::shared_ptr<const core::Graph> > snapshots;
+    bool ready() override {
+        if (this->busy) {
+            this->pending = true;
+            return false;
+        }
+        return true;
+    }
+    void update(const std::shared_ptr<const core::Graph> &snapshot) override {
+        this->snapshots.push_back(snapshot);
+    }
+};
+
+core::EndPoint endpoint(int port) {
+    core::EndPoint endpoint;
+    endpoint.set_ip("127.0.0.1");
+    endpoint.set_port(port);
+    return endpoint;
+}
+
+int main() {
+    core::MasterGraph graph;
+    std::shared_ptr<const core::Graph> empty = graph.snapshot();
+    CHECK(empty->version() == 0 && empty->topics_size() == 0);
+    /* one snapshot per version, shared by every caller */
+    CHECK(graph.snapshot() == empty);
+
+    Watcher first, second;
+    graph.watch(&first);
+    graph.watch(&second);
+    CHECK(first.snapshots.size() == 1 && first.snapshots[0] == empty);
+    graph.add_publisher("chatter", "hello.hello", endpoint(1));
+    graph.add_subscriber("chatter", endpoint(2));
+    CHECK(first.snapshots.size() == 3 && second.snapshots.size() == 3);
+    CHECK(first.snapshots[2] == second.snapshots[2]);
+    CHECK(first.snapshots[2] == graph.snapshot());
+    std::shared_ptr<const core::Graph> linked = graph.snapshot();
+    CHECK(linked->version() == 2);
+    CHECK(linked->topics_size() == 1 && linked->topics(0).type_name() == "hello.hello");
+    CHECK(linked->topics(0).publishers_size() == 1 && linked->topics(0).subscribers_size() == 1);
+    CHECK(linked->nodes_size() == 2);
+
+    /* a snapshot handed out stays as it was while the graph changes */
+    graph.remove_subscriber("chatter", endpoint(2));
+    graph.remove_publisher("chatter", endpoint(1));
+    CHECK(linked->topics_size() == 1 && linked->topics(0).subscribers_size() == 1);
+    CHECK(graph.snapshot()->topics_size() == 0 && graph.snapshot()->version() == 4);
+
+    /* busy watchers are skipped, nothing is built for them, and they catch up with the newest version */
+    first.busy = second.busy = true;
+    size_t seen = first.snapshots.size();
+    for (int i = 0; i < 10; i++) graph.add_service_server("service" + std::to_string(i), endpoint(3));
+    CHECK(first.snapshots.size() == seen && first.pending);
+    first.busy = false;
+    std::shared_ptr<const core::Graph> newest = graph.snapshot();
+    CHECK(newest->version() == 14 && newest->services_size() == 10);
+    CHECK(newest->services(0).server().port() == 3);
+    graph.add_service_client("service0", endpoint(4));
+    CHECK(first.snapshots.size() == seen + 1 && first.snapshots.back()->version() == 15);
+    CHECK(second.snapshots.size() == seen);
+
+    /* removing what is not there changes nothing */
+    graph.remove_service_server("no_such_service", endpoint(3));
+    CHECK(graph.snapshot()->version() == 15);
+    graph.unwatch(&first);
+    graph.remove_service_client("service0", endpoint(4));
+    CHECK(first.snapshots.size() == seen + 1);
+    std::cout << "GraphTest passed\n";
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+#include <dirent.h>
+
+#include <atomic>
+
+/*
+ * A node can be destroyed while the process goes on: its threads are joined, not left running
+ * against the freed node, so creating and destroying nodes does not pile up threads. The same
+ * holds for multicast discovery.
+ */
+using Message = config_msg::ConfigStamped;
+
+std::atomic<int> received(0);
+
+void on_config(Message msg) {
+    received++;
+}
+
+void echo(Message request, Message &reply) {
+    reply = request;
+}
+
+size_t threads() {
+    size_t count = 0;
+    DIR *tasks = opendir("/proc/self/task");
+    while (dirent *entry = readdir(tasks)) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(tasks);
+    return count;
+}
+
+/* a node that publishes, subscribes and serves, used once and destroyed */
+void cycle(core::NodeHandler &peer, core::Publisher<Message> &peer_pub) {
+    core::NodeHandler *node = new core::NodeHandler();
+    core::Publisher<Message> &pub = node->advertise<Message>("lifetime_out", 10);
+    core::Subscriber<Message> &sub = node->subscribe<Message>("lifetime_in", 0, on_config, 10);
+    node->serviceServer<Message, Message>("lifetime_echo", echo);
+    core::ServiceClient<Message, Message> &client = node->serviceClient<Message, Message>("lifetime_echo");
+    CHECK(pub.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(sub.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(client.waitForMatched(1, std::chrono::seconds(5)));
+    Message reply;
+    CHECK(client.pull_request(Message(), reply));
+    received = 0;
+    CHECK(test::eventually([&]() {
+        peer_pub.publish(Message());
+        pub.publish(Message());
+        core::spinOnce();
+        return received >= 2;
+    }));
+    delete node;
+}
+
+int main() {
+    test::useMaster();
+    /* the peer outlives main and is never destroyed */
+    core::NodeHandler *peer = new core::NodeHandler();
+    core::Publisher<Message> &peer_pub = peer->advertise<Message>("lifetime_in", 10);
+    peer->subscribe<Message>("lifetime_out", 0, on_config, 10);
+
+    /* multicast discovery, where the host allows it, stops its beacon and receive threads as well */
+    {
+        size_t alone = threads();
+        core::EndPoint self;
+        self.set_ip("127.0.0.1");
+        self.set_port(1);
+        bool ret = false;
+        core::Discovery *discovery = new core::Discovery(self, "239.255.0.1:10011", [](const core::EndPoint &endpoint) {}, ret);
+        std::cout << "multicast discovery " << (ret ? "running" : "unavailable") << "\n";
+        delete discovery;
+        CHECK(threads() == alone);
+    }
+
+    cycle(*peer, peer_pub);
+    size_t before = threads();
+    for (int i = 0; i < 3; i++) cycle(*peer, peer_pub);
+    /* gRPC's own pools may grow a little, a node's threads would add dozens per cycle */
+    size_t after = threads();
+    std::cout << "threads " << before << " -> " << after << "\n";
+    CHECK(after <= before + 4);
+    std::cout << "LifetimeTest passed\n";
+    return 0;
+}
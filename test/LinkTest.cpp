@@ -0,0 +1,68 @@
+#include "Link.h"
+#include "Check.h"
+
+#include <atomic>
+
+/* frames published over a link arrive in order under their topic id, over the unix socket and over tcp */
+struct Received {
+    std::mutex mutex_;
+    std::vector<std::string> frames;
+    size_t size() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return this->frames.size();
+    }
+};
+
+void roundTrip(core::LinkManager &subscriber, core::LinkManager &publisher, bool use_uds) {
+    Received first, second;
+    uint32_t first_id = subscriber.add_sink([&](const char *data, uint32_t size, const std::shared_ptr<core::InLink> &link) {
+        std::lock_guard<std::mutex> lock(first.mutex_);
+        first.frames.push_back(std::string(data, size));
+    });
+    uint32_t second_id = subscriber.add_sink([&](const char *data, uint32_t size, const std::shared_ptr<core::InLink> &link) {
+        std::lock_guard<std::mutex> lock(second.mutex_);
+        second.frames.push_back(std::string(data, size));
+    });
+    CHECK(first_id != second_id);
+    std::shared_ptr<core::OutLink> link = publisher.link_to(subscriber.ip, subscriber.tcp_port, use_uds ? subscriber.uds_path : "");
+    CHECK(link);
+    /* both topics share the one link to the node */
+    CHECK(publisher.link_to(subscriber.ip, subscriber.tcp_port, use_uds ? subscriber.uds_path : "") == link);
+    core::FlowControl flow;
+    std::shared_ptr<core::OutChannel> first_channel = link->add_channel(first_id, 0, 100, flow);
+    std::shared_ptr<core::OutChannel> second_channel = link->add_channel(second_id, 0, 100, flow);
+    for (int i = 0; i < 50; i++) {
+        CHECK(first_channel->push(std::make_shared<const std::string>("first " + std::to_string(i))));
+        if (i % 2 == 0) CHECK(second_channel->push(std::make_shared<const std::string>(std::string(1000 * i, 'x'))));
+    }
+    /* an empty message is a valid frame too */
+    CHECK(first_channel->push(std::make_shared<const std::string>()));
+    CHECK(test::eventually([&]() { return first.size() == 51 && second.size() == 25; }));
+    for (int i = 0; i < 50; i++) CHECK(first.frames[i] == "first " + std::to_string(i));
+    CHECK(first.frames[50].empty());
+    for (int i = 0; i < 25; i++) CHECK(second.frames[i] == std::string(2000 * i, 'x'));
+}
+
+int main() {
+    /* the link threads outlive main, the managers are never destroyed */
+    core::LinkManager *subscriber = new core::LinkManager("127.0.0.1");
+    core::LinkManager *publisher = new core::LinkManager("127.0.0.1");
+    CHECK(subscriber->tcp_port != 0);
+    CHECK(!subscriber->uds_path.empty());
+    roundTrip(*subscriber, *publisher, true);
+    roundTrip(*subscriber, *publisher, false);
+    /* topics connecting to the same node at once end up on one link */
+    core::LinkManager *other = new core::LinkManager("127.0.0.1");
+    std::vector<std::shared_ptr<core::OutLink> > links(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < links.size(); i++) {
+        threads.push_back(std::thread([&, i]() { links[i] = publisher->link_to(other->ip, other->tcp_port, ""); }));
+    }
+    for (std::thread &thread : threads) thread.join();
+    for (auto &link : links) CHECK(link && link == links[0]);
+    CHECK(publisher->link_to(other->ip, other->tcp_port, "") == links[0]);
+    /* nothing listens there */
+    CHECK(!publisher->link_to("127.0.0.1", subscriber->tcp_port, "no-such-socket"));
+    std::cout << "LinkTest passed\n";
+    return 0;
+}
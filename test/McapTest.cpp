@@ -0,0 +1,90 @@
+#include "Mcap.h"
+#include "Check.h"
+#include "Config.pb.h"
+#include "Motor.pb.h"
+
+/* a recording written by McapWriter reads back with its schemas, channels, time range and messages in time order */
+int main() {
+    std::string path = "/tmp/grpccore_mcap_test." + std::to_string(getpid()) + ".mcap";
+    const uint64_t base = 1700000000000000000ull;
+    const uint64_t ms = 1000000;
+    std::vector<std::pair<uint64_t, std::string> > written;
+    {
+        bool ret = false;
+        /* small chunks, so the messages end up in several of them */
+        core::McapWriter writer(path, "", 1024, ret);
+        CHECK(ret);
+        uint16_t config_channel = writer.add_channel("config");
+        uint16_t motor_channel = writer.add_channel("motor");
+        CHECK(config_channel != motor_channel);
+        for (int i = 0; i < 300; i++) {
+            /* subscriber threads do not log in order: every tenth message is 5 ms late, and the
+               messages span 3 s so chunks are also closed by duration */
+            uint64_t log_time = base + i * 10 * ms - (i % 10 == 9 ? 15 * ms : 0);
+            std::string payload;
+            if (i % 2 == 0) {
+                config_msg::ConfigStamped config;
+                config.set_address(i);
+                payload = config.SerializeAsString();
+                writer.write(config_channel, config_msg::ConfigStamped::descriptor()->full_name(), log_time, payload.data(), payload.size());
+            }
+            else {
+                motor_msg::MotorState motor;
+                motor.set_theta(i);
+                payload = motor.SerializeAsString();
+                writer.write(motor_channel, motor_msg::MotorState::descriptor()->full_name(), log_time, payload.data(), payload.size());
+            }
+            written.push_back(std::make_pair(log_time, payload));
+        }
+        writer.close();
+        CHECK(writer.messages() == 300);
+    }
+    std::stable_sort(written.begin(), written.end(), [](const std::pair<uint64_t, std::string> &a, const std::pair<uint64_t, std::string> &b) {
+        return a.first < b.first;
+    });
+
+    bool ret = false;
+    core::McapReader reader(path, ret);
+    CHECK(ret);
+    /* statistics in the summary */
+    CHECK(reader.start_time == written.front().first);
+    CHECK(reader.end_time == written.back().first);
+    CHECK(reader.channels.size() == 2);
+    std::map<std::string, std::string> types;
+    for (auto &pair : reader.channels) {
+        CHECK(pair.second.message_encoding == "protobuf");
+        CHECK(reader.schemas.count(pair.second.schema_id) == 1);
+        const core::McapReader::Schema &schema = reader.schemas[pair.second.schema_id];
+        CHECK(schema.encoding == "protobuf");
+        /* the schema is enough to parse the messages without the compiled-in type */
+        google::protobuf::FileDescriptorSet set;
+        CHECK(set.ParseFromString(schema.data) && set.file_size() > 0);
+        types[pair.second.topic] = schema.name;
+    }
+    CHECK(types["config"] == "config_msg.ConfigStamped");
+    CHECK(types["motor"] == "motor_msg.MotorState");
+
+    std::vector<std::pair<uint64_t, std::string> > read;
+    reader.read(0, [&](const core::McapReader::Message &msg) {
+        read.push_back(std::make_pair(msg.log_time, std::string(msg.data, msg.size)));
+        return true;
+    });
+    CHECK(read.size() == written.size());
+    for (size_t i = 0; i + 1 < read.size(); i++) CHECK(read[i].first <= read[i + 1].first);
+    std::multiset<std::pair<uint64_t, std::string> > expected(written.begin(), written.end());
+    std::multiset<std::pair<uint64_t, std::string> > actual(read.begin(), read.end());
+    CHECK(expected == actual);
+
+    /* seeking: nothing before from, and returning false stops the playback */
+    uint64_t from = base + 1500 * ms;
+    size_t count = 0;
+    reader.read(from, [&](const core::McapReader::Message &msg) {
+        CHECK(msg.log_time >= from);
+        count++;
+        return count < 10;
+    });
+    CHECK(count == 10);
+    unlink(path.c_str());
+    std::cout << "McapTest passed\n";
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "NodeHandler.h"
+#include "Check.h"
+#include "Config.pb.h"
+
+#include <atomic>
+
+/*
+ * Publisher and subscriber find each other whichever starts first: a subscriber that comes second
+ * asks the publisher's node for a link (Path 2), a publisher that comes second asks the subscriber's
+ * node where to open one (Path 1). Both sides count the other as matched either way.
+ */
+std::atomic<int> received_publisher_first(0);
+std::atomic<int> received_subscriber_first(0);
+
+void on_publisher_first(config_msg::ConfigStamped msg) {
+    received_publisher_first++;
+}
+
+void on_subscriber_first(config_msg::ConfigStamped msg) {
+    received_subscriber_first++;
+}
+
+bool delivered(core::Publisher<config_msg::ConfigStamped> &pub, std::atomic<int> &received) {
+    return test::eventually([&]() {
+        pub.publish(config_msg::ConfigStamped());
+        core::spinOnce();
+        return received > 0;
+    });
+}
+
+int main() {
+    test::useMaster();
+    /* the node threads outlive main, the nodes are never destroyed */
+    core::NodeHandler *publisher_node = new core::NodeHandler();
+    core::NodeHandler *subscriber_node = new core::NodeHandler();
+
+    core::Publisher<config_msg::ConfigStamped> &first_pub = publisher_node->advertise<config_msg::ConfigStamped>("publisher_first", 10);
+    core::Subscriber<config_msg::ConfigStamped> &second_sub = subscriber_node->subscribe<config_msg::ConfigStamped>("publisher_first", 0, on_publisher_first, 10);
+    CHECK(first_pub.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(second_sub.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(delivered(first_pub, received_publisher_first));
+
+    core::Subscriber<config_msg::ConfigStamped> &first_sub = subscriber_node->subscribe<config_msg::ConfigStamped>("subscriber_first", 0, on_subscriber_first, 10);
+    core::Publisher<config_msg::ConfigStamped> &second_pub = publisher_node->advertise<config_msg::ConfigStamped>("subscriber_first", 10);
+    CHECK(second_pub.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(first_sub.waitForMatched(1, std::chrono::seconds(5)));
+    CHECK(delivered(second_pub, received_subscriber_first));
+    CHECK(first_sub.matched() == 1 && second_pub.matched() == 1);
+
+    /* a filter the published type cannot evaluate fails the handshake, whichever side starts first */
+    core::Filter bad_filter = core::Filter().where("no_such_field", core::FieldFilter::GE, 1);
+    core::Publisher<config_msg::ConfigStamped> &early_pub = publisher_node->advertise<config_msg::ConfigStamped>("filtered_late", 10);
+    core::Subscriber<config_msg::ConfigStamped> &late_filtered = subscriber_node->subscribe<config_msg::ConfigStamped>("filtered_late", 0, on_publisher_first, 10, bad_filter);
+    CHECK(test::eventually([&]() { return !late_filtered.refusal().empty(); }));
+    CHECK(late_filtered.matched() == 0 && early_pub.matched() == 0);
+    core::Subscriber<config_msg::ConfigStamped> &early_filtered = subscriber_node->subscribe<config_msg::ConfigStamped>("filtered_first", 0, on_subscriber_first, 10, bad_filter);
+    core::Publisher<config_msg::ConfigStamped> &filtered_pub = publisher_node->advertise<config_msg::ConfigStamped>("filtered_first", 10);
+    CHECK(test::eventually([&]() { return !early_filtered.refusal().empty(); }));
+    CHECK(early_filtered.matched() == 0 && filtered_pub.matched() == 0);
+
+    /* a handshake for a topic the node does not have is refused, not dereferenced */
+    core::EndPoint node;
+    node.set_ip("127.0.0.1");
+    node.set_port(subscriber_node->rpc_port);
+    std::unique_ptr<core::Connection::Stub> stub = core::Connection::NewStub(subscriber_node->channel(node));
+    {
+        grpc::ClientContext context;
+        core::PublisherRequest request;
+        core::PublisherReply reply;
+        request.set_topic_name("no_such_topic");
+        CHECK(stub->Publisher(&context, request, &reply).error_code() == grpc::StatusCode::NOT_FOUND);
+    }
+    {
+        grpc::ClientContext context;
+        core::SubscriberRequest request;
+        core::SubscriberReply reply;
+        request.set_topic_name("no_such_topic");
+        CHECK(stub->Subscriber(&context, request, &reply).error_code() == grpc::StatusCode::NOT_FOUND);
+    }
+    std::cout << "StartOrderTest passed\n";
+    return 0;
+}
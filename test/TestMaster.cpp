@@ -0,0 +1,11 @@
+#include "Master.h"
+#include "Check.h"
+
+/* the master lives in its own translation unit, Master.h and NodeHandler.h both define core symbols */
+namespace test {
+    void startMaster(const std::string &address) {
+        std::thread([address]() { core::RunServer(address); }).detach();
+        /* nodes retry their registration stream, this only saves them the first second */
+        usleep(100000);
+    }
+}